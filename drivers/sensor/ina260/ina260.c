@@ -19,7 +19,16 @@ LOG_MODULE_REGISTER(ina260, LOG_LEVEL_DBG);
 
 #include "ina260.h"
 
-static int ina260_reg_read(const struct device *dev,
+/* Values selected by the AVG and conversion time fields, by field value */
+static const uint16_t avg_counts[] = { 1, 4, 16, 64, 128, 256, 512, 1024 };
+static const uint16_t conversion_times_us[] = { 140, 204, 332, 588, 1100, 2116, 4156, 8244 };
+
+/* MODE field value for each enum ina260_mode; also used in the devicetree initializer */
+#define INA260_MODE_BITS(mode)						\
+	((mode) == INA260_MODE_CONTINUOUS ? 0x7 :			\
+	 (mode) == INA260_MODE_TRIGGERED ? 0x3 : 0x0)
+
+int ina260_reg_read(const struct device *dev,
 		uint8_t reg_addr,
 		uint16_t *reg_data)
 {
@@ -36,8 +45,123 @@ static int ina260_reg_read(const struct device *dev,
 	return err;
 }
 
-static int ina260_sample_fetch(const struct device *dev,
-			       enum sensor_channel chan)
+int ina260_reg_write(const struct device *dev,
+		uint8_t reg_addr,
+		uint16_t reg_data)
+{
+	const struct ina260_device_config *cfg = dev->config;
+	uint8_t tx_buf[3];
+
+	tx_buf[0] = reg_addr;
+	sys_put_be16(reg_data, &tx_buf[1]);
+
+	return i2c_write_dt(&cfg->bus, tx_buf, sizeof(tx_buf));
+}
+
+/*
+ * Reading the Mask/Enable register clears its flags, so it is only read here.
+ * The flags are kept in data->flags until the conversion poll or the trigger
+ * handler consumes the one it is interested in.
+ */
+int ina260_read_flags(const struct device *dev)
+{
+	struct ina260_data *data = dev->data;
+	uint16_t mask;
+	int err;
+
+	err = ina260_reg_read(dev, INA260_REG_MASK, &mask);
+	if (err) {
+		LOG_ERR("Error reading mask/enable register: %d", err);
+		return err;
+	}
+
+	atomic_or(&data->flags, mask & (INA260_MASK_AFF | INA260_MASK_CVRF));
+
+	return 0;
+}
+
+static int find_index(const uint16_t *table, size_t len, int32_t value)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (table[i] == value) {
+			return i;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static uint8_t config_field(uint16_t config, uint8_t shift)
+{
+	return (config >> shift) & INA260_CONFIG_FIELD_MASK;
+}
+
+static enum ina260_mode config_mode(uint16_t config)
+{
+	switch (config & INA260_CONFIG_MODE_MASK) {
+	case 0x7:
+		return INA260_MODE_CONTINUOUS;
+	case 0x3:
+		return INA260_MODE_TRIGGERED;
+	default:
+		return INA260_MODE_SHUTDOWN;
+	}
+}
+
+/* Time taken by one averaged conversion of both current and voltage */
+static uint32_t conversion_time_us(uint16_t config)
+{
+	return avg_counts[config_field(config, INA260_CONFIG_AVG_SHIFT)] *
+	       (conversion_times_us[config_field(config, INA260_CONFIG_VBUSCT_SHIFT)] +
+		conversion_times_us[config_field(config, INA260_CONFIG_ISHCT_SHIFT)]);
+}
+
+/* Start a single conversion and wait for it to complete */
+static int ina260_trigger_conversion(const struct device *dev)
+{
+	struct ina260_data *data = dev->data;
+	uint32_t wait_us = conversion_time_us(data->config);
+	int err;
+
+	/* A flag left from an earlier conversion must not end this wait */
+	atomic_and(&data->flags, ~INA260_MASK_CVRF);
+
+	/* Writing the configuration register in triggered mode starts a conversion */
+	err = ina260_reg_write(dev, INA260_REG_CONFIG, data->config);
+	if (err) {
+		return err;
+	}
+
+	k_usleep(wait_us);
+
+	/* Allow for oscillator tolerance before giving up */
+	for (int i = 0; i < 10; i++) {
+		err = ina260_read_flags(dev);
+		if (err) {
+			return err;
+		}
+
+#ifdef CONFIG_INA260_TRIGGER
+		/* The read released the ALERT pin, so the limit alert may never reach the GPIO */
+		if ((atomic_get(&data->flags) & INA260_MASK_AFF) && data->th_handler &&
+		    !ina260_alert_held_off(dev)) {
+			k_work_submit(&data->work);
+		}
+#endif
+
+		/* The trigger handler may have read the flag first */
+		if (atomic_and(&data->flags, ~INA260_MASK_CVRF) & INA260_MASK_CVRF) {
+			return 0;
+		}
+
+		k_usleep(wait_us / 10 + 1);
+	}
+
+	return -ETIMEDOUT;
+}
+
+static int ina260_fetch(const struct device *dev,
+			enum sensor_channel chan)
 {
 	int err;
 	uint16_t reading;
@@ -51,6 +175,20 @@ static int ina260_sample_fetch(const struct device *dev,
 		return -ENOTSUP;
 	}
 
+	switch (config_mode(data->config)) {
+	case INA260_MODE_SHUTDOWN:
+		return -ENODATA;
+	case INA260_MODE_TRIGGERED:
+		err = ina260_trigger_conversion(dev);
+		if (err) {
+			LOG_ERR("Error triggering conversion: %d", err);
+			return err;
+		}
+		break;
+	default:
+		break;
+	}
+
 	if (chan == SENSOR_CHAN_ALL ||
 		chan == SENSOR_CHAN_VOLTAGE) {
 
@@ -86,25 +224,74 @@ static int ina260_sample_fetch(const struct device *dev,
 	return err;
 }
 
-static int ina260_channel_get(const struct device *dev,
-			      enum sensor_channel chan,
-			      struct sensor_value *val)
+int ina260_sample_fetch(const struct device *dev, enum sensor_channel chan)
 {
+	struct ina260_data *data = dev->data;
 	int err;
+
+	k_mutex_lock(&data->lock, K_FOREVER);
+	err = ina260_fetch(dev, chan);
+	k_mutex_unlock(&data->lock);
+
+	return err;
+}
+
+#ifdef CONFIG_INA260_DOUBLE_CONVERSION
+static int ina260_convert(enum sensor_channel chan,
+			  const struct ina260_data *data,
+			  struct sensor_value *val)
+{
 	double calculated;
 
-	struct ina260_data *data = dev->data;
+	switch (chan) {
+	case SENSOR_CHAN_VOLTAGE:
+		calculated = ((double)data->vol * INA260_PER_BIT_MULT) / INA260_CALC_DIVISOR;
+		break;
+	case SENSOR_CHAN_POWER:
+		calculated = (double)data->pow / INA260_POWER_DIVISOR;
+		break;
+	default:
+		calculated = ((double)data->cur * INA260_PER_BIT_MULT) / INA260_CALC_DIVISOR;
+		break;
+	}
 
-	switch ((int16_t)chan) {
+	return sensor_value_from_double(val, calculated);
+}
+#else
+/* Current and voltage LSBs are INA260_UNITS_PER_BIT_MICRO, power INA260_POWER_PER_BIT_MICRO */
+static int ina260_convert(enum sensor_channel chan,
+			  const struct ina260_data *data,
+			  struct sensor_value *val)
+{
+	int64_t micro;
+
+	switch (chan) {
 	case SENSOR_CHAN_VOLTAGE:
-		calculated = ((double)data->vol * 125) / 100000;
+		micro = (int64_t)data->vol * INA260_UNITS_PER_BIT_MICRO;
 		break;
 	case SENSOR_CHAN_POWER:
-		calculated = (double)data->pow / 100;
+		micro = (int64_t)data->pow * INA260_POWER_PER_BIT_MICRO;
 		break;
-	case SENSOR_CHAN_CURRENT:
-		calculated = ((double)data->cur * 125) / 100000;
+	default:
+		micro = (int64_t)data->cur * INA260_UNITS_PER_BIT_MICRO;
 		break;
+	}
+
+	return sensor_value_from_micro(val, micro);
+}
+#endif /* CONFIG_INA260_DOUBLE_CONVERSION */
+
+static int ina260_channel_get(const struct device *dev,
+			      enum sensor_channel chan,
+			      struct sensor_value *val)
+{
+	struct ina260_data *data = dev->data;
+
+	switch ((int16_t)chan) {
+	case SENSOR_CHAN_VOLTAGE:
+	case SENSOR_CHAN_POWER:
+	case SENSOR_CHAN_CURRENT:
+		return ina260_convert(chan, data, val);
 	case SENSOR_CHAN_INA260_VOLTAGE_RAW:
 		val->val1 = data->vol;
 		return 0;
@@ -117,33 +304,306 @@ static int ina260_channel_get(const struct device *dev,
 	default:
 		return -ENOTSUP;
 	}
+}
+
+/*
+ * Convert a threshold to the units of the Alert Limit register, which match the
+ * register being compared. Raw channels take a register value in val1. Returns
+ * -EINVAL if the value does not fit the register.
+ */
+static int ina260_limit_from_value(enum sensor_channel chan,
+				   const struct sensor_value *val,
+				   uint16_t *limit)
+{
+	int64_t value;
+
+	switch ((int)chan) {
+	case SENSOR_CHAN_CURRENT:
+	case SENSOR_CHAN_VOLTAGE:
+		value = sensor_value_to_micro(val) / INA260_UNITS_PER_BIT_MICRO;
+		break;
+	case SENSOR_CHAN_POWER:
+		value = sensor_value_to_micro(val) / INA260_POWER_PER_BIT_MICRO;
+		break;
+	case SENSOR_CHAN_INA260_CURRENT_RAW:
+	case SENSOR_CHAN_INA260_VOLTAGE_RAW:
+	case SENSOR_CHAN_INA260_POWER_RAW:
+		value = val->val1;
+		break;
+	default:
+		return -ENOTSUP;
+	}
+
+	/* Current is signed; voltage and power are not */
+	if (((chan == SENSOR_CHAN_CURRENT) || ((int)chan == SENSOR_CHAN_INA260_CURRENT_RAW)) ?
+	    !IN_RANGE(value, INT16_MIN, INT16_MAX) : !IN_RANGE(value, 0, UINT16_MAX)) {
+		return -EINVAL;
+	}
+
+	*limit = (uint16_t)value;
+	return 0;
+}
+
+static int ina260_set_limit(const struct device *dev,
+			    enum sensor_channel chan,
+			    enum sensor_attribute attr,
+			    const struct sensor_value *val)
+{
+	struct ina260_data *data = dev->data;
+	bool upper = (attr == SENSOR_ATTR_UPPER_THRESH);
+	uint16_t func;
+	uint16_t limit;
+	int err;
+
+	switch ((int)chan) {
+	case SENSOR_CHAN_CURRENT:
+	case SENSOR_CHAN_INA260_CURRENT_RAW:
+		func = upper ? INA260_MASK_OCL : INA260_MASK_UCL;
+		break;
+	case SENSOR_CHAN_VOLTAGE:
+	case SENSOR_CHAN_INA260_VOLTAGE_RAW:
+		func = upper ? INA260_MASK_BOL : INA260_MASK_BUL;
+		break;
+	case SENSOR_CHAN_POWER:
+	case SENSOR_CHAN_INA260_POWER_RAW:
+		if (!upper) {
+			return -ENOTSUP;
+		}
+		func = INA260_MASK_POL;
+		break;
+	default:
+		return -ENOTSUP;
+	}
+
+	err = ina260_limit_from_value(chan, val, &limit);
+	if (err) {
+		return err;
+	}
+
+	err = ina260_reg_write(dev, INA260_REG_ALERT_LIMIT, limit);
+	if (err) {
+		LOG_ERR("Error writing alert limit register: %d", err);
+		return err;
+	}
+
+	err = ina260_reg_write(dev, INA260_REG_MASK,
+			       (data->mask & ~INA260_MASK_LIMIT_FUNCS) | func);
+	if (err) {
+		LOG_ERR("Error writing mask/enable register: %d", err);
+		return err;
+	}
+
+	data->mask = (data->mask & ~INA260_MASK_LIMIT_FUNCS) | func;
+	LOG_DBG("%s alert limit: 0x%04x, mask/enable: 0x%04x", dev->name,
+		limit, data->mask);
+
+	return 0;
+}
+
+static int ina260_disable_limit(const struct device *dev)
+{
+	struct ina260_data *data = dev->data;
+	int err;
+
+	err = ina260_reg_write(dev, INA260_REG_MASK, data->mask & ~INA260_MASK_LIMIT_FUNCS);
+	if (err) {
+		LOG_ERR("Error writing mask/enable register: %d", err);
+		return err;
+	}
+
+	data->mask &= ~INA260_MASK_LIMIT_FUNCS;
+	return 0;
+}
+
+/* Caller must hold data->lock */
+static int ina260_attr_update(const struct device *dev,
+			      enum sensor_channel chan,
+			      enum sensor_attribute attr,
+			      const struct sensor_value *val)
+{
+	struct ina260_data *data = dev->data;
+	uint16_t config = data->config;
+	uint8_t shift;
+	int idx;
+	int err;
+
+	if ((attr == SENSOR_ATTR_UPPER_THRESH) || (attr == SENSOR_ATTR_LOWER_THRESH)) {
+		return ina260_set_limit(dev, chan, attr, val);
+	}
+
+	if (chan != SENSOR_CHAN_ALL) {
+		return -ENOTSUP;
+	}
+
+	if (attr == SENSOR_ATTR_ALERT) {
+		/* Limits are enabled by setting a threshold, so only disabling is supported */
+		return (val->val1 == 0) ? ina260_disable_limit(dev) : -ENOTSUP;
+	}
+
+	switch ((int)attr) {
+	case SENSOR_ATTR_OVERSAMPLING:
+		idx = find_index(avg_counts, ARRAY_SIZE(avg_counts), val->val1);
+		shift = INA260_CONFIG_AVG_SHIFT;
+		break;
+	case SENSOR_ATTR_INA260_VBUS_CONVERSION_TIME:
+		idx = find_index(conversion_times_us, ARRAY_SIZE(conversion_times_us), val->val1);
+		shift = INA260_CONFIG_VBUSCT_SHIFT;
+		break;
+	case SENSOR_ATTR_INA260_ISHUNT_CONVERSION_TIME:
+		idx = find_index(conversion_times_us, ARRAY_SIZE(conversion_times_us), val->val1);
+		shift = INA260_CONFIG_ISHCT_SHIFT;
+		break;
+	case SENSOR_ATTR_INA260_MODE:
+		if ((val->val1 < 0) || (val->val1 > INA260_MODE_CONTINUOUS)) {
+			return -EINVAL;
+		}
+		config = (config & ~INA260_CONFIG_MODE_MASK) | INA260_MODE_BITS(val->val1);
+		goto write;
+	default:
+		return -ENOTSUP;
+	}
+
+	if (idx < 0) {
+		return -EINVAL;
+	}
+
+	config &= ~(INA260_CONFIG_FIELD_MASK << shift);
+	config |= idx << shift;
+
+write:
+	if (config == data->config) {
+		return 0;
+	}
+
+	err = ina260_reg_write(dev, INA260_REG_CONFIG, config);
+	if (err) {
+		LOG_ERR("Error writing configuration register: %d", err);
+		return err;
+	}
+
+	data->config = config;
+	LOG_DBG("%s configuration: 0x%04x", dev->name, config);
+
+	return 0;
+}
+
+static int ina260_attr_set(const struct device *dev,
+			   enum sensor_channel chan,
+			   enum sensor_attribute attr,
+			   const struct sensor_value *val)
+{
+	struct ina260_data *data = dev->data;
+	int err;
+
+	/* Keeps the sampler from fetching with a half-written configuration */
+	k_mutex_lock(&data->lock, K_FOREVER);
+	err = ina260_attr_update(dev, chan, attr, val);
+	k_mutex_unlock(&data->lock);
 
-	err = sensor_value_from_double(val, calculated);
 	return err;
 }
 
+static int ina260_attr_get(const struct device *dev,
+			   enum sensor_channel chan,
+			   enum sensor_attribute attr,
+			   struct sensor_value *val)
+{
+	struct ina260_data *data = dev->data;
+
+	if (chan != SENSOR_CHAN_ALL) {
+		return -ENOTSUP;
+	}
+
+	switch ((int)attr) {
+	case SENSOR_ATTR_OVERSAMPLING:
+		val->val1 = avg_counts[config_field(data->config, INA260_CONFIG_AVG_SHIFT)];
+		break;
+	case SENSOR_ATTR_INA260_VBUS_CONVERSION_TIME:
+		val->val1 = conversion_times_us[config_field(data->config,
+							     INA260_CONFIG_VBUSCT_SHIFT)];
+		break;
+	case SENSOR_ATTR_INA260_ISHUNT_CONVERSION_TIME:
+		val->val1 = conversion_times_us[config_field(data->config,
+							     INA260_CONFIG_ISHCT_SHIFT)];
+		break;
+	case SENSOR_ATTR_INA260_MODE:
+		val->val1 = config_mode(data->config);
+		break;
+	default:
+		return -ENOTSUP;
+	}
+
+	val->val2 = 0;
+	return 0;
+}
+
 static int ina260_init(const struct device *dev)
 {
 	const struct ina260_device_config *config = dev->config;
+	struct ina260_data *data = dev->data;
+	int err;
 
 	if (!device_is_ready(config->bus.bus)) {
 		LOG_ERR("Bus device is not ready");
 		return -ENODEV;
 	}
 
+	k_mutex_init(&data->lock);
+	data->config = config->config;
+
+	err = ina260_reg_write(dev, INA260_REG_CONFIG, config->config);
+	if (err) {
+		LOG_ERR("Error writing configuration register: %d", err);
+		return err;
+	}
+
+	/* Latch alerts so that a fault is not missed between reads */
+	data->mask = INA260_MASK_LEN;
+
+	err = ina260_reg_write(dev, INA260_REG_MASK, data->mask);
+	if (err) {
+		LOG_ERR("Error writing mask/enable register: %d", err);
+		return err;
+	}
+
+#ifdef CONFIG_INA260_TRIGGER
+	if (config->alert_gpio.port != NULL) {
+		err = ina260_trigger_init(dev);
+		if (err) {
+			LOG_ERR("Unable to set up alert pin: %d", err);
+			return err;
+		}
+	}
+#endif
+
 	return 0;
 }
 
 static const struct sensor_driver_api ina260_api = {
+	.attr_set = ina260_attr_set,
+	.attr_get = ina260_attr_get,
+#ifdef CONFIG_INA260_TRIGGER
+	.trigger_set = ina260_trigger_set,
+#endif
 	.sample_fetch = ina260_sample_fetch,
-	.channel_get = ina260_channel_get
+	.channel_get = ina260_channel_get,
+#ifdef CONFIG_SENSOR_ASYNC_API
+	.submit = ina260_submit,
+	.get_decoder = ina260_get_decoder,
+#endif
 };
 
 #define INA260_INIT(n)									\
 	static struct ina260_data ina260_data_##n;					\
 											\
 	static const struct ina260_device_config ina260_device_config_##n = {		\
-		.bus = I2C_DT_SPEC_INST_GET(n)						\
+		.bus = I2C_DT_SPEC_INST_GET(n),						\
+		.config = INA260_CONFIG(DT_INST_ENUM_IDX(n, avg_count),			\
+					DT_INST_ENUM_IDX(n, vbus_conversion_time_us),	\
+					DT_INST_ENUM_IDX(n, ishunt_conversion_time_us),	\
+					INA260_MODE_BITS(DT_INST_ENUM_IDX(n, mode))),	\
+		IF_ENABLED(CONFIG_INA260_TRIGGER,					\
+			   (.alert_gpio = GPIO_DT_SPEC_INST_GET_OR(n, alert_gpios, {0}),)) \
 	};										\
 											\
 	SENSOR_DEVICE_DT_INST_DEFINE(n, ina260_init, NULL,				\
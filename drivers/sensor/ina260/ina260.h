@@ -7,37 +7,120 @@
 #ifndef __INA260_H__
 #define __INA260_H__
 
+#include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/i2c.h>
 #include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <drivers/sensor/ina260.h>
 
 /* Register addresses */
+#define INA260_REG_CONFIG	0x00
 #define INA260_REG_CURRENT	0x01
 #define INA260_REG_VOLTAGE	0x02
 #define INA260_REG_POWER	0x03
+#define INA260_REG_MASK		0x06
+#define INA260_REG_ALERT_LIMIT	0x07
 
-/* Calc values */
-#define INA260_PER_BIT_MULT 125
-#define INA260_CALC_DIVISOR 100000
-
-/* Custom channels */
-enum sensor_channel_ina260 {
-	/** RAW Voltage Reading **/
-	SENSOR_CHAN_INA260_VOLTAGE_RAW = SENSOR_CHAN_PRIV_START,
-	/** RAW Current Reading **/
-	SENSOR_CHAN_INA260_CURRENT_RAW,
-	/** RAW Power Reading **/
-	SENSOR_CHAN_INA260_POWER_RAW
-};
+/* Configuration register fields */
+#define INA260_CONFIG_RST		BIT(15)
+#define INA260_CONFIG_FIXED		0x6000
+#define INA260_CONFIG_AVG_SHIFT		9
+#define INA260_CONFIG_VBUSCT_SHIFT	6
+#define INA260_CONFIG_ISHCT_SHIFT	3
+#define INA260_CONFIG_FIELD_MASK	0x7
+#define INA260_CONFIG_MODE_MASK		0x7
+
+#define INA260_CONFIG(avg, vbusct, ishct, mode)				\
+	(INA260_CONFIG_FIXED |						\
+	 ((avg) << INA260_CONFIG_AVG_SHIFT) |				\
+	 ((vbusct) << INA260_CONFIG_VBUSCT_SHIFT) |			\
+	 ((ishct) << INA260_CONFIG_ISHCT_SHIFT) |			\
+	 (mode))
+
+/* Mask/Enable register fields */
+#define INA260_MASK_OCL		BIT(15)
+#define INA260_MASK_UCL		BIT(14)
+#define INA260_MASK_BOL		BIT(13)
+#define INA260_MASK_BUL		BIT(12)
+#define INA260_MASK_POL		BIT(11)
+#define INA260_MASK_CNVR	BIT(10)
+#define INA260_MASK_AFF		BIT(4)
+#define INA260_MASK_CVRF	BIT(3)
+#define INA260_MASK_LEN		BIT(0)
+
+/* Only one limit function can be enabled at a time */
+#define INA260_MASK_LIMIT_FUNCS						\
+	(INA260_MASK_OCL | INA260_MASK_UCL | INA260_MASK_BOL |		\
+	 INA260_MASK_BUL | INA260_MASK_POL)
+
+/* Q31 shifts used by the decoder: +/-64 A, 128 V and 1024 W full scale */
+#define INA260_CURRENT_SHIFT	6
+#define INA260_VOLTAGE_SHIFT	7
+#define INA260_POWER_SHIFT	10
 
 /* Structs */
 struct ina260_device_config {
 	struct i2c_dt_spec bus;
+	/* Configuration register value from devicetree */
+	uint16_t config;
+#ifdef CONFIG_INA260_TRIGGER
+	struct gpio_dt_spec alert_gpio;
+#endif
 };
 
 struct ina260_data {
+	/* Serializes register read-modify-write sequences and fetches */
+	struct k_mutex lock;
 	int16_t vol;
 	int16_t cur;
 	uint16_t pow;
+	/* Configuration register value currently in use */
+	uint16_t config;
+	/* Enable bits of the Mask/Enable register currently in use */
+	uint16_t mask;
+	/* AFF and CVRF flags read from the Mask/Enable register and not yet handled */
+	atomic_t flags;
+#ifdef CONFIG_INA260_TRIGGER
+	const struct device *dev;
+	struct gpio_callback gpio_cb;
+	struct k_work work;
+	/* Enables the pin interrupt again after a limit alert */
+	struct k_work_delayable rearm_work;
+	sensor_trigger_handler_t drdy_handler;
+	const struct sensor_trigger *drdy_trigger;
+	sensor_trigger_handler_t th_handler;
+	const struct sensor_trigger *th_trigger;
+#endif
+};
+
+int ina260_sample_fetch(const struct device *dev, enum sensor_channel chan);
+int ina260_reg_read(const struct device *dev, uint8_t reg_addr, uint16_t *reg_data);
+int ina260_reg_write(const struct device *dev, uint8_t reg_addr, uint16_t reg_data);
+int ina260_read_flags(const struct device *dev);
+
+#ifdef CONFIG_SENSOR_ASYNC_API
+/* Buffer filled by a read request and interpreted by the decoder */
+struct ina260_encoded_data {
+	/* Uptime in nanoseconds when the registers were read */
+	uint64_t timestamp;
+	int16_t cur;
+	int16_t vol;
+	uint16_t pow;
 };
 
+void ina260_submit(const struct device *dev, struct rtio_iodev_sqe *iodev_sqe);
+int ina260_get_decoder(const struct device *dev, const struct sensor_decoder_api **decoder);
+#endif
+
+#ifdef CONFIG_INA260_TRIGGER
+int ina260_trigger_set(const struct device *dev,
+		       const struct sensor_trigger *trig,
+		       sensor_trigger_handler_t handler);
+int ina260_trigger_init(const struct device *dev);
+/* True while limit alerts are held off after the last one */
+bool ina260_alert_held_off(const struct device *dev);
+#endif
+
 #endif /* INA260_H__ */
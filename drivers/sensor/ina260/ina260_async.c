@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_DECLARE(ina260, LOG_LEVEL_DBG);
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/rtio/rtio.h>
+
+#include "ina260.h"
+
+BUILD_ASSERT(sizeof(struct ina260_encoded_data) <= INA260_ENCODED_DATA_SIZE);
+
+/*
+ * The I2C bus has no RTIO backend, so the registers are read synchronously in
+ * the submitting context and the request is completed before returning.
+ * Every channel is always read; the decoder picks out the ones requested.
+ */
+void ina260_submit(const struct device *dev, struct rtio_iodev_sqe *iodev_sqe)
+{
+	uint32_t min_buf_len = sizeof(struct ina260_encoded_data);
+	struct ina260_data *data = dev->data;
+	struct ina260_encoded_data *edata;
+	uint8_t *buf;
+	uint32_t buf_len;
+	int err;
+
+	err = rtio_sqe_rx_buf(iodev_sqe, min_buf_len, min_buf_len, &buf, &buf_len);
+	if (err) {
+		LOG_ERR("Failed to get a read buffer of size %u bytes", min_buf_len);
+		rtio_iodev_sqe_err(iodev_sqe, err);
+		return;
+	}
+
+	/* Held across the copy so another fetch cannot replace the readings */
+	k_mutex_lock(&data->lock, K_FOREVER);
+
+	err = ina260_sample_fetch(dev, SENSOR_CHAN_ALL);
+	if (err) {
+		k_mutex_unlock(&data->lock);
+		rtio_iodev_sqe_err(iodev_sqe, err);
+		return;
+	}
+
+	edata = (struct ina260_encoded_data *)buf;
+	edata->timestamp = k_ticks_to_ns_floor64(k_uptime_ticks());
+	edata->cur = data->cur;
+	edata->vol = data->vol;
+	edata->pow = data->pow;
+
+	k_mutex_unlock(&data->lock);
+
+	rtio_iodev_sqe_ok(iodev_sqe, 0);
+}
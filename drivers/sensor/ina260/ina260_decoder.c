@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define DT_DRV_COMPAT ti_ina260
+
+#include <zephyr/drivers/sensor.h>
+
+#include "ina260.h"
+
+/* Scale a register value to Q31 with the given shift: raw * mult / div * 2^(31 - shift) */
+static q31_t ina260_to_q31(int32_t raw, int32_t mult, int32_t div, int8_t shift)
+{
+	/* Multiply rather than shift: negative currents would make a left shift undefined */
+	return (q31_t)(((int64_t)raw * mult * ((int64_t)1 << (31 - shift))) / div);
+}
+
+static bool ina260_decoder_supports(struct sensor_chan_spec chan_spec)
+{
+	if (chan_spec.chan_idx != 0) {
+		return false;
+	}
+
+	switch (chan_spec.chan_type) {
+	case SENSOR_CHAN_CURRENT:
+	case SENSOR_CHAN_VOLTAGE:
+	case SENSOR_CHAN_POWER:
+	case SENSOR_CHAN_INA260_CURRENT_RAW:
+	case SENSOR_CHAN_INA260_VOLTAGE_RAW:
+	case SENSOR_CHAN_INA260_POWER_RAW:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int ina260_decoder_get_frame_count(const uint8_t *buffer,
+					  struct sensor_chan_spec chan_spec,
+					  uint16_t *frame_count)
+{
+	ARG_UNUSED(buffer);
+
+	if (!ina260_decoder_supports(chan_spec)) {
+		return -ENOTSUP;
+	}
+
+	*frame_count = 1;
+	return 0;
+}
+
+static int ina260_decoder_get_size_info(struct sensor_chan_spec chan_spec,
+					size_t *base_size,
+					size_t *frame_size)
+{
+	if (!ina260_decoder_supports(chan_spec)) {
+		return -ENOTSUP;
+	}
+
+	*base_size = sizeof(struct sensor_q31_data);
+	*frame_size = sizeof(struct sensor_q31_sample_data);
+	return 0;
+}
+
+/*
+ * Current, voltage and power are decoded in A, V and W. The raw channels are
+ * decoded with a shift of 31, so the Q31 value is the register value itself.
+ */
+static int ina260_decoder_decode(const uint8_t *buffer,
+				 struct sensor_chan_spec chan_spec,
+				 uint32_t *fit,
+				 uint16_t max_count,
+				 void *data_out)
+{
+	const struct ina260_encoded_data *edata = (const struct ina260_encoded_data *)buffer;
+	struct sensor_q31_data *out = data_out;
+
+	if ((*fit != 0) || (max_count == 0)) {
+		return 0;
+	}
+
+	if (!ina260_decoder_supports(chan_spec)) {
+		return -ENOTSUP;
+	}
+
+	out->header.base_timestamp_ns = edata->timestamp;
+	out->header.reading_count = 1;
+	out->readings[0].timestamp_delta = 0;
+
+	switch (chan_spec.chan_type) {
+	case SENSOR_CHAN_CURRENT:
+		out->shift = INA260_CURRENT_SHIFT;
+		out->readings[0].value = ina260_to_q31(edata->cur, INA260_PER_BIT_MULT,
+						       INA260_CALC_DIVISOR, out->shift);
+		break;
+	case SENSOR_CHAN_VOLTAGE:
+		out->shift = INA260_VOLTAGE_SHIFT;
+		out->readings[0].value = ina260_to_q31(edata->vol, INA260_PER_BIT_MULT,
+						       INA260_CALC_DIVISOR, out->shift);
+		break;
+	case SENSOR_CHAN_POWER:
+		out->shift = INA260_POWER_SHIFT;
+		out->readings[0].value = ina260_to_q31(edata->pow, 1, INA260_POWER_DIVISOR,
+						       out->shift);
+		break;
+	case SENSOR_CHAN_INA260_CURRENT_RAW:
+		out->shift = 31;
+		out->readings[0].value = edata->cur;
+		break;
+	case SENSOR_CHAN_INA260_VOLTAGE_RAW:
+		out->shift = 31;
+		out->readings[0].value = edata->vol;
+		break;
+	case SENSOR_CHAN_INA260_POWER_RAW:
+		out->shift = 31;
+		out->readings[0].value = edata->pow;
+		break;
+	}
+
+	*fit = 1;
+	return 1;
+}
+
+static bool ina260_decoder_has_trigger(const uint8_t *buffer, enum sensor_trigger_type trigger)
+{
+	ARG_UNUSED(buffer);
+	ARG_UNUSED(trigger);
+
+	return false;
+}
+
+SENSOR_DECODER_API_DT_DEFINE() = {
+	.get_frame_count = ina260_decoder_get_frame_count,
+	.get_size_info = ina260_decoder_get_size_info,
+	.decode = ina260_decoder_decode,
+	.has_trigger = ina260_decoder_has_trigger,
+};
+
+int ina260_get_decoder(const struct device *dev, const struct sensor_decoder_api **decoder)
+{
+	ARG_UNUSED(dev);
+
+	*decoder = &SENSOR_DECODER_NAME();
+	return 0;
+}
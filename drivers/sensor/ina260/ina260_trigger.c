@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_DECLARE(ina260, LOG_LEVEL_DBG);
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+
+#include "ina260.h"
+
+static void ina260_gpio_callback(const struct device *port,
+				 struct gpio_callback *cb,
+				 uint32_t pin)
+{
+	struct ina260_data *data = CONTAINER_OF(cb, struct ina260_data, gpio_cb);
+	const struct ina260_device_config *config = data->dev->config;
+
+	/* Level triggered: keep it off until the alert is cleared over I2C */
+	gpio_pin_interrupt_configure_dt(&config->alert_gpio, GPIO_INT_DISABLE);
+	k_work_submit(&data->work);
+}
+
+static void ina260_rearm_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct ina260_data *data = CONTAINER_OF(dwork, struct ina260_data, rearm_work);
+	const struct ina260_device_config *config = data->dev->config;
+
+	gpio_pin_interrupt_configure_dt(&config->alert_gpio, GPIO_INT_LEVEL_ACTIVE);
+}
+
+static void ina260_work_handler(struct k_work *work)
+{
+	struct ina260_data *data = CONTAINER_OF(work, struct ina260_data, work);
+	const struct device *dev = data->dev;
+	const struct ina260_device_config *config = dev->config;
+	bool limit = false;
+
+	/* Releases the pin; flags already read by the conversion poll are handled here too */
+	k_mutex_lock(&data->lock, K_FOREVER);
+	ina260_read_flags(dev);
+	k_mutex_unlock(&data->lock);
+
+	/* A triggered-mode conversion poll waits on CVRF unless data-ready is in use */
+	if (data->drdy_handler &&
+	    (atomic_and(&data->flags, ~INA260_MASK_CVRF) & INA260_MASK_CVRF)) {
+		data->drdy_handler(dev, data->drdy_trigger);
+	}
+
+	if (data->th_handler &&
+	    (atomic_and(&data->flags, ~INA260_MASK_AFF) & INA260_MASK_AFF)) {
+		data->th_handler(dev, data->th_trigger);
+		limit = true;
+	}
+
+	if (limit && !data->drdy_handler) {
+		/* A lasting fault latches the alert again after every conversion */
+		k_work_reschedule(&data->rearm_work, K_MSEC(CONFIG_INA260_ALERT_HOLDOFF_MS));
+	} else if (!k_work_delayable_is_pending(&data->rearm_work)) {
+		gpio_pin_interrupt_configure_dt(&config->alert_gpio, GPIO_INT_LEVEL_ACTIVE);
+	}
+}
+
+bool ina260_alert_held_off(const struct device *dev)
+{
+	struct ina260_data *data = dev->data;
+
+	return k_work_delayable_is_pending(&data->rearm_work);
+}
+
+int ina260_trigger_set(const struct device *dev,
+		       const struct sensor_trigger *trig,
+		       sensor_trigger_handler_t handler)
+{
+	const struct ina260_device_config *config = dev->config;
+	struct ina260_data *data = dev->data;
+	uint16_t mask;
+	int err = 0;
+
+	if (config->alert_gpio.port == NULL) {
+		return -ENOTSUP;
+	}
+
+	if (trig->chan != SENSOR_CHAN_ALL) {
+		return -ENOTSUP;
+	}
+
+	if ((trig->type != SENSOR_TRIG_DATA_READY) && (trig->type != SENSOR_TRIG_THRESHOLD)) {
+		return -ENOTSUP;
+	}
+
+	/* Limit attributes write the same register */
+	k_mutex_lock(&data->lock, K_FOREVER);
+	mask = data->mask;
+
+	switch (trig->type) {
+	case SENSOR_TRIG_DATA_READY:
+		data->drdy_handler = handler;
+		data->drdy_trigger = trig;
+
+		/* Conversion-ready is the only source that needs enabling; limits are
+		 * enabled by setting a threshold attribute
+		 */
+		if (handler) {
+			mask |= INA260_MASK_CNVR;
+		} else {
+			mask &= ~INA260_MASK_CNVR;
+		}
+		break;
+	case SENSOR_TRIG_THRESHOLD:
+		data->th_handler = handler;
+		data->th_trigger = trig;
+		break;
+	default:
+		break;
+	}
+
+	if (mask != data->mask) {
+		err = ina260_reg_write(dev, INA260_REG_MASK, mask);
+		if (err) {
+			LOG_ERR("Error writing mask/enable register: %d", err);
+		} else {
+			data->mask = mask;
+		}
+	}
+
+	k_mutex_unlock(&data->lock);
+	return err;
+}
+
+int ina260_trigger_init(const struct device *dev)
+{
+	const struct ina260_device_config *config = dev->config;
+	struct ina260_data *data = dev->data;
+	int err;
+
+	data->dev = dev;
+	k_work_init(&data->work, ina260_work_handler);
+	k_work_init_delayable(&data->rearm_work, ina260_rearm_handler);
+
+	if (!gpio_is_ready_dt(&config->alert_gpio)) {
+		LOG_ERR("Alert GPIO device is not ready");
+		return -ENODEV;
+	}
+
+	err = gpio_pin_configure_dt(&config->alert_gpio, GPIO_INPUT);
+	if (err) {
+		return err;
+	}
+
+	gpio_init_callback(&data->gpio_cb, ina260_gpio_callback, BIT(config->alert_gpio.pin));
+
+	err = gpio_add_callback(config->alert_gpio.port, &data->gpio_cb);
+	if (err) {
+		return err;
+	}
+
+	return gpio_pin_interrupt_configure_dt(&config->alert_gpio, GPIO_INT_LEVEL_ACTIVE);
+}
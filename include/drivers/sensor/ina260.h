@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2023 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Public interface of the TI INA260 driver: the raw channels, the custom
+ * attributes and the scale of the raw readings.
+ */
+
+#ifndef __INCLUDE_DRIVERS_SENSOR_INA260_H__
+#define __INCLUDE_DRIVERS_SENSOR_INA260_H__
+
+#include <zephyr/drivers/sensor.h>
+
+/* Calc values */
+#define INA260_PER_BIT_MULT 125
+#define INA260_CALC_DIVISOR 100000
+#define INA260_POWER_DIVISOR 100
+#define INA260_UNITS_PER_BIT_MICRO 1250
+#define INA260_POWER_PER_BIT_MICRO 10000
+
+/* Size of the buffer a read request fills, for sizing RTIO memory pool blocks */
+#define INA260_ENCODED_DATA_SIZE 16
+
+/* Custom channels */
+enum sensor_channel_ina260 {
+	/** RAW Voltage Reading **/
+	SENSOR_CHAN_INA260_VOLTAGE_RAW = SENSOR_CHAN_PRIV_START,
+	/** RAW Current Reading **/
+	SENSOR_CHAN_INA260_CURRENT_RAW,
+	/** RAW Power Reading **/
+	SENSOR_CHAN_INA260_POWER_RAW
+};
+
+/**
+ * Custom attributes, set on SENSOR_CHAN_ALL. SENSOR_ATTR_OVERSAMPLING sets the
+ * number of conversions averaged by the device (1, 4, 16, 64, 128, 256, 512 or
+ * 1024).
+ */
+enum sensor_attribute_ina260 {
+	/** Bus voltage conversion time in microseconds **/
+	SENSOR_ATTR_INA260_VBUS_CONVERSION_TIME = SENSOR_ATTR_PRIV_START,
+	/** Shunt current conversion time in microseconds **/
+	SENSOR_ATTR_INA260_ISHUNT_CONVERSION_TIME,
+	/** Operating mode, one of enum ina260_mode **/
+	SENSOR_ATTR_INA260_MODE
+};
+
+/* Operating modes, in the order of the devicetree mode property */
+enum ina260_mode {
+	INA260_MODE_SHUTDOWN,
+	INA260_MODE_TRIGGERED,
+	INA260_MODE_CONTINUOUS
+};
+
+#endif /* __INCLUDE_DRIVERS_SENSOR_INA260_H__ */
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_alert, LOG_LEVEL_DBG);
+
+#include <golioth/client.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+
+#include "app_alert.h"
+#include "app_encode.h"
+#include "app_store.h"
+
+#include <drivers/sensor/ina260.h>
+
+#define ALERT_STREAM_ENDP "event"
+
+struct alert_channel {
+	const struct device *dev;
+	uint8_t ch_num;
+	enum app_alert_func func;
+	int32_t limit;
+	/* Limit alerts arrive on the ALERT pin rather than from the sampler */
+	bool hw;
+	/* Sampler path: last sample was outside the limit */
+	bool tripped;
+	/* Uptime in milliseconds of the last event sent */
+	int64_t last_event;
+	uint32_t suppressed;
+	struct k_work work;
+};
+
+static struct alert_channel channels[ADC_NUM_CHANNELS];
+static size_t channel_count;
+static struct k_spinlock alert_lock;
+
+K_THREAD_STACK_DEFINE(alert_stack, CONFIG_APP_ALERT_STACK_SIZE);
+static struct k_work_q alert_wq;
+
+static const char *const func_names[] = {
+	[APP_ALERT_NONE] = "none",
+	[APP_ALERT_OVER_CURRENT] = "over_current",
+	[APP_ALERT_UNDER_CURRENT] = "under_current",
+	[APP_ALERT_OVER_VOLTAGE] = "over_voltage",
+	[APP_ALERT_UNDER_VOLTAGE] = "under_voltage",
+	[APP_ALERT_OVER_POWER] = "over_power",
+};
+
+static void alert_work_handler(struct k_work *work)
+{
+	struct alert_channel *ch = CONTAINER_OF(work, struct alert_channel, work);
+	struct app_alert_event event = { .ch_num = ch->ch_num };
+	uint8_t cbor_buf[APP_ENCODE_EVENT_MAX_SIZE];
+	struct app_sample sample;
+	int age_offset;
+	int len;
+	int err;
+
+	k_spinlock_key_t key = k_spin_lock(&alert_lock);
+
+	event.func = func_names[ch->func];
+	event.limit = ch->limit;
+	event.suppressed = ch->suppressed;
+	ch->suppressed = 0;
+
+	k_spin_unlock(&alert_lock, key);
+
+	if (app_sampler_latest(ch->ch_num, &sample) == 0) {
+		event.ts = k_ticks_to_ms_floor64(sample.ts);
+		event.raw = sample.raw;
+		event.has_sample = true;
+	}
+
+	LOG_WRN("ch%d: %s alert (limit %d)", ch->ch_num, event.func, event.limit);
+
+	len = app_encode_event(cbor_buf, sizeof(cbor_buf), &event, &age_offset);
+	if (len < 0) {
+		return;
+	}
+
+	/* Not held up by a replay of queued telemetry */
+	err = app_store_stream_urgent(ALERT_STREAM_ENDP,
+				      GOLIOTH_CONTENT_TYPE_CBOR,
+				      cbor_buf,
+				      len,
+				      k_uptime_get(),
+				      age_offset);
+	if (err) {
+		LOG_ERR("Failed to send alert event to Golioth: %d", err);
+	}
+}
+
+/* Queue an event unless one was sent recently; caller must hold alert_lock */
+static void raise_alert(struct alert_channel *ch)
+{
+	int64_t now = k_uptime_get();
+
+	if ((ch->last_event > 0) && (now - ch->last_event < CONFIG_APP_ALERT_HOLDOFF_MS)) {
+		ch->suppressed++;
+		return;
+	}
+
+	ch->last_event = now;
+	k_work_submit_to_queue(&alert_wq, &ch->work);
+}
+
+static bool outside_limit(enum app_alert_func func, int32_t limit, const vcp_raw_t *raw)
+{
+	switch (func) {
+	case APP_ALERT_OVER_CURRENT:
+		return raw->current > limit;
+	case APP_ALERT_UNDER_CURRENT:
+		return raw->current < limit;
+	case APP_ALERT_OVER_VOLTAGE:
+		return raw->voltage > limit;
+	case APP_ALERT_UNDER_VOLTAGE:
+		return raw->voltage < limit;
+	case APP_ALERT_OVER_POWER:
+		return raw->power > limit;
+	default:
+		return false;
+	}
+}
+
+/* Check channels without an ALERT pin against their limit on every sample frame */
+static void alert_listener_cb(const struct zbus_channel *chan)
+{
+	const struct app_sample_frame *frame = zbus_chan_const_msg(chan);
+	struct alert_channel *ch;
+	bool outside;
+
+	k_spinlock_key_t key = k_spin_lock(&alert_lock);
+
+	for (size_t i = 0; i < channel_count; i++) {
+		ch = &channels[i];
+
+		if (ch->hw || !(frame->channels & BIT(i))) {
+			continue;
+		}
+
+		outside = outside_limit(ch->func, ch->limit, &frame->raw[i]);
+
+		/* Only report crossing the limit, not every sample beyond it */
+		if (outside && !ch->tripped) {
+			raise_alert(ch);
+		}
+		ch->tripped = outside;
+	}
+
+	k_spin_unlock(&alert_lock, key);
+}
+
+ZBUS_LISTENER_DEFINE(alert_lis, alert_listener_cb);
+ZBUS_CHAN_ADD_OBS(sample_chan, alert_lis, 2);
+
+#ifdef CONFIG_INA260_TRIGGER
+static void limit_alert_handler(const struct device *dev, const struct sensor_trigger *trig)
+{
+	for (size_t i = 0; i < channel_count; i++) {
+		if (channels[i].dev == dev) {
+			k_spinlock_key_t key = k_spin_lock(&alert_lock);
+
+			raise_alert(&channels[i]);
+			k_spin_unlock(&alert_lock, key);
+			return;
+		}
+	}
+}
+
+static bool enable_limit_alert(const struct device *dev)
+{
+	static const struct sensor_trigger trig = {
+		.type = SENSOR_TRIG_THRESHOLD,
+		.chan = SENSOR_CHAN_ALL,
+	};
+
+	return sensor_trigger_set(dev, &trig, limit_alert_handler) == 0;
+}
+#else
+static bool enable_limit_alert(const struct device *dev)
+{
+	return false;
+}
+#endif /* CONFIG_INA260_TRIGGER */
+
+int app_alert_configure(uint8_t ch_num, enum app_alert_func func, int32_t limit)
+{
+	struct sensor_value val = { .val1 = limit };
+	struct alert_channel *ch;
+	enum sensor_channel chan;
+	enum sensor_attribute attr;
+	int err;
+
+	if ((ch_num >= channel_count) || (func >= APP_ALERT_NUM_FUNCS)) {
+		return -EINVAL;
+	}
+
+	ch = &channels[ch_num];
+
+	switch (func) {
+	case APP_ALERT_NONE:
+		val.val1 = 0;
+		chan = SENSOR_CHAN_ALL;
+		attr = SENSOR_ATTR_ALERT;
+		break;
+	case APP_ALERT_OVER_CURRENT:
+	case APP_ALERT_UNDER_CURRENT:
+		chan = (enum sensor_channel)SENSOR_CHAN_INA260_CURRENT_RAW;
+		attr = (func == APP_ALERT_OVER_CURRENT) ? SENSOR_ATTR_UPPER_THRESH
+							: SENSOR_ATTR_LOWER_THRESH;
+		break;
+	case APP_ALERT_OVER_VOLTAGE:
+	case APP_ALERT_UNDER_VOLTAGE:
+		chan = (enum sensor_channel)SENSOR_CHAN_INA260_VOLTAGE_RAW;
+		attr = (func == APP_ALERT_OVER_VOLTAGE) ? SENSOR_ATTR_UPPER_THRESH
+							: SENSOR_ATTR_LOWER_THRESH;
+		break;
+	default:
+		chan = (enum sensor_channel)SENSOR_CHAN_INA260_POWER_RAW;
+		attr = SENSOR_ATTR_UPPER_THRESH;
+		break;
+	}
+
+	/* Program the Alert Limit register even without a pin so the hardware state matches */
+	err = sensor_attr_set(ch->dev, chan, attr, &val);
+	if (err) {
+		LOG_ERR("Unable to set ch%d alert limit: %d", ch_num, err);
+		return err;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&alert_lock);
+
+	ch->func = func;
+	ch->limit = limit;
+	ch->tripped = false;
+
+	k_spin_unlock(&alert_lock, key);
+
+	LOG_INF("ch%d: %s alert at %d (%s)", ch_num, func_names[func], limit,
+		ch->hw ? "ALERT pin" : "sampler");
+
+	return 0;
+}
+
+void app_alert_init(adc_node_t **nodes, size_t count)
+{
+	struct k_work_queue_config cfg = {
+		.name = "alert",
+	};
+
+	k_work_queue_start(&alert_wq, alert_stack, K_THREAD_STACK_SIZEOF(alert_stack),
+			   CONFIG_APP_ALERT_THREAD_PRIORITY, &cfg);
+
+	channel_count = MIN(count, ARRAY_SIZE(channels));
+
+	for (size_t i = 0; i < channel_count; i++) {
+		channels[i].dev = nodes[i]->dev;
+		channels[i].ch_num = nodes[i]->ch_num;
+		k_work_init(&channels[i].work, alert_work_handler);
+
+		channels[i].hw = enable_limit_alert(nodes[i]->dev);
+	}
+}
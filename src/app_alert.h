@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Per-channel alert limits, reported as soon as they trip.
+ *
+ * Limits are programmed into the INA260 Alert Limit register. Channels with
+ * an ALERT pin (see CONFIG_INA260_TRIGGER) are interrupt driven; the others
+ * are checked by a listener on the sample_chan zbus channel. Either way an event is sent to
+ * the "event" Stream path from a dedicated high-priority work queue, without
+ * waiting for the next report.
+ */
+
+#ifndef __APP_ALERT_H__
+#define __APP_ALERT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "app_sampler.h"
+#include "app_sensors.h"
+
+/** Limit checked on a channel; values match the ALERT_FUNC_CHn setting */
+enum app_alert_func {
+	APP_ALERT_NONE,
+	APP_ALERT_OVER_CURRENT,
+	APP_ALERT_UNDER_CURRENT,
+	APP_ALERT_OVER_VOLTAGE,
+	APP_ALERT_UNDER_VOLTAGE,
+	APP_ALERT_OVER_POWER,
+	APP_ALERT_NUM_FUNCS
+};
+
+/**
+ * @brief Start the event work queue and register for INA260 limit alerts
+ *
+ * @param nodes Array of channels, indexed by channel number
+ * @param count Number of entries in @p nodes
+ */
+void app_alert_init(adc_node_t **nodes, size_t count);
+
+/**
+ * @brief Set the limit checked on a channel
+ *
+ * @param ch_num Channel number
+ * @param func Quantity and direction of the limit, or APP_ALERT_NONE to disable it
+ * @param limit Limit in raw INA260 units
+ *
+ * @return 0 on success, or a negative error code
+ */
+int app_alert_configure(uint8_t ch_num, enum app_alert_func func, int32_t limit);
+
+#endif /* __APP_ALERT_H__ */
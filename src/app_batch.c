@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_batch, LOG_LEVEL_DBG);
+
+#include <string.h>
+#include <zcbor_encode.h>
+#include <zephyr/kernel.h>
+
+#include "app_batch.h"
+#include "app_encode.h"
+#include "app_store.h"
+
+#define BATCH_STREAM_ENDP "sensor/batch"
+
+struct batch_record {
+	/* Uptime in milliseconds when the report window closed */
+	int64_t ts;
+	struct vcp_report ch[ADC_NUM_CHANNELS];
+};
+
+static struct batch_record records[CONFIG_APP_STREAM_BATCH_SIZE];
+static size_t record_count;
+static K_MUTEX_DEFINE(batch_mutex);
+
+/* Map with the age and the "reports" key around the list of reports */
+#define BATCH_MAX_SIZE (24 + (CONFIG_APP_STREAM_BATCH_SIZE * APP_ENCODE_REPORT_MAX_SIZE))
+
+BUILD_ASSERT(BATCH_MAX_SIZE + APP_STORE_ENTRY_OVERHEAD + sizeof(BATCH_STREAM_ENDP) <=
+		     CONFIG_APP_STORE_MAX_ENTRY_SIZE,
+	     "Sensor batch does not fit in the offline queue; lower APP_STREAM_BATCH_SIZE");
+
+static uint8_t cbor_buf[BATCH_MAX_SIZE];
+
+static void flush_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(flush_work, flush_work_handler);
+
+static void flush_work_handler(struct k_work *work)
+{
+	int64_t now = k_uptime_get();
+	int age_offset;
+	bool ok;
+	int err;
+
+	k_mutex_lock(&batch_mutex, K_FOREVER);
+
+	if (record_count == 0) {
+		goto unlock;
+	}
+
+	ZCBOR_STATE_E(zse, 6, cbor_buf, sizeof(cbor_buf), 1);
+	ok = zcbor_map_start_encode(zse, 2) &&
+	     app_encode_age(zse, cbor_buf, &age_offset) &&
+	     zcbor_tstr_put_lit(zse, "reports") &&
+	     zcbor_list_start_encode(zse, CONFIG_APP_STREAM_BATCH_SIZE);
+	for (size_t i = 0; ok && (i < record_count); i++) {
+		/* Timestamps are relative to the capture time; "age" is added when sent */
+		int64_t t = records[i].ts - now;
+
+		ok = app_encode_report_map(zse, records[i].ch, ADC_NUM_CHANNELS, &t);
+	}
+	ok = ok && zcbor_list_end_encode(zse, CONFIG_APP_STREAM_BATCH_SIZE) &&
+	     zcbor_map_end_encode(zse, 2);
+
+	if (!ok) {
+		LOG_ERR("Failed to encode sensor batch: %d", zcbor_peek_error(zse));
+		record_count = 0;
+		goto unlock;
+	}
+
+	/* Queued in flash if the client is offline */
+	err = app_store_stream(BATCH_STREAM_ENDP,
+			       GOLIOTH_CONTENT_TYPE_CBOR,
+			       cbor_buf,
+			       zse->payload - cbor_buf,
+			       now,
+			       age_offset);
+	if (err) {
+		/* Neither sent nor queued; retrying would most likely fail the same way */
+		LOG_ERR("Failed to send sensor batch to Golioth, dropping %d reports: %d",
+			record_count, err);
+	} else {
+		LOG_DBG("Sent %d reports in %d bytes", record_count, zse->payload - cbor_buf);
+	}
+
+	record_count = 0;
+
+unlock:
+	k_mutex_unlock(&batch_mutex);
+}
+
+int app_batch_add(const struct vcp_report *reports, size_t count)
+{
+	if (count > ADC_NUM_CHANNELS) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&batch_mutex, K_FOREVER);
+
+	if (record_count == ARRAY_SIZE(records)) {
+		/* Previous flush has not gone out; make room by dropping the oldest report */
+		LOG_WRN("Sensor batch full; dropping oldest report");
+		memmove(&records[0], &records[1], sizeof(records[0]) * (record_count - 1));
+		record_count--;
+	}
+
+	memset(&records[record_count], 0, sizeof(records[0]));
+	records[record_count].ts = k_uptime_get();
+	memcpy(records[record_count].ch, reports, sizeof(reports[0]) * count);
+	record_count++;
+
+	if (record_count == ARRAY_SIZE(records)) {
+		k_work_reschedule_for_queue(app_store_work_q(), &flush_work, K_NO_WAIT);
+	} else {
+		/* Does nothing if the age timer is already running */
+		k_work_schedule_for_queue(app_store_work_q(), &flush_work,
+					  K_SECONDS(CONFIG_APP_STREAM_BATCH_MAX_AGE_S));
+	}
+
+	k_mutex_unlock(&batch_mutex);
+
+	return 0;
+}
+
+void app_batch_flush(void)
+{
+	k_work_reschedule_for_queue(app_store_work_q(), &flush_work, K_NO_WAIT);
+}
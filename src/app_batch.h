@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Buffer sensor reports and upload them to Golioth Stream as a single CBOR
+ * array, so that several reports share the cost of one CoAP exchange.
+ *
+ * A batch is sent when it holds `CONFIG_APP_STREAM_BATCH_SIZE` reports, when
+ * the oldest report is `CONFIG_APP_STREAM_BATCH_MAX_AGE_S` seconds old, or when
+ * app_batch_flush() is called.
+ */
+
+#ifndef __APP_BATCH_H__
+#define __APP_BATCH_H__
+
+#include <stddef.h>
+#include "app_sensors.h"
+
+/**
+ * @brief Add one report window to the batch
+ *
+ * @param reports Summary of each channel, indexed by channel number
+ * @param count Number of entries in @p reports
+ *
+ * @return 0 on success, or a negative error code
+ */
+int app_batch_add(const struct vcp_report *reports, size_t count);
+
+/**
+ * @brief Send all buffered reports as soon as possible
+ *
+ * Safe to call from any context, including interrupts.
+ */
+void app_batch_flush(void);
+
+#endif /* __APP_BATCH_H__ */
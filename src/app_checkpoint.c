@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_checkpoint, LOG_LEVEL_DBG);
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/crc.h>
+
+#include "app_checkpoint.h"
+#include "app_sensors.h"
+
+#define CHECKPOINT_SUBTREE "app/ckpt"
+
+/* Saved alternately as CHECKPOINT_SUBTREE/0 and /1; a changed channel count changes the size */
+struct checkpoint_record {
+	uint32_t gen;
+	/* Keeps the CRC from covering uninitialized padding */
+	uint32_t reserved;
+	struct app_checkpoint data;
+	uint32_t crc;
+};
+
+/* Last record saved or restored; only used from the system work queue after start */
+static struct app_checkpoint last_saved;
+static uint32_t last_gen;
+static bool have_record;
+
+static atomic_t save_requested;
+
+static void checkpoint_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(checkpoint_work, checkpoint_work_handler);
+
+static uint32_t record_crc(const struct checkpoint_record *rec)
+{
+	return crc32_ieee((const uint8_t *)rec, offsetof(struct checkpoint_record, crc));
+}
+
+static int load_record(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg,
+		       void *param)
+{
+	struct checkpoint_record rec;
+
+	if ((len != sizeof(rec)) || (read_cb(cb_arg, &rec, sizeof(rec)) != sizeof(rec))) {
+		LOG_WRN("Ignoring checkpoint %s of %d bytes", key, (int)len);
+		return 0;
+	}
+
+	if (rec.crc != record_crc(&rec)) {
+		LOG_WRN("Ignoring checkpoint %s with bad CRC", key);
+		return 0;
+	}
+
+	/* Generations wrap, so compare the difference */
+	if (!have_record || ((int32_t)(rec.gen - last_gen) > 0)) {
+		last_saved = rec.data;
+		last_gen = rec.gen;
+		have_record = true;
+	}
+
+	return 0;
+}
+
+int app_checkpoint_load(struct app_checkpoint *out)
+{
+	int err;
+
+	err = settings_subsys_init();
+	if (err) {
+		return err;
+	}
+
+	err = settings_load_subtree_direct(CHECKPOINT_SUBTREE, load_record, NULL);
+	if (err) {
+		return err;
+	}
+
+	if (!have_record) {
+		return -ENOENT;
+	}
+
+	LOG_INF("Restored checkpoint %u", last_gen);
+
+	*out = last_saved;
+	return 0;
+}
+
+static int save(const struct app_checkpoint *checkpoint)
+{
+	struct checkpoint_record rec = {
+		.gen = last_gen + 1,
+		.data = *checkpoint,
+	};
+	char key[sizeof(CHECKPOINT_SUBTREE "/0")];
+	int err;
+
+	rec.crc = record_crc(&rec);
+
+	/* Overwrite the older record so the newer one survives a failed write */
+	snprintk(key, sizeof(key), CHECKPOINT_SUBTREE "/%u", rec.gen & 1);
+
+	err = settings_save_one(key, &rec, sizeof(rec));
+	if (err) {
+		LOG_ERR("Unable to save checkpoint: %d", err);
+		return err;
+	}
+
+	last_saved = rec.data;
+	last_gen = rec.gen;
+	have_record = true;
+
+	return 0;
+}
+
+static bool worth_saving(const struct app_checkpoint *checkpoint,
+			 const struct adc_counters *counters)
+{
+	if (!have_record) {
+		return true;
+	}
+
+	for (size_t i = 0; i < ADC_NUM_CHANNELS; i++) {
+		struct adc_counters saved = { .energy_acc = last_saved.energy_acc[i] };
+
+		if ((checkpoint->cumulative[i] < last_saved.cumulative[i]) ||
+		    (checkpoint->cumulative[i] - last_saved.cumulative[i] >=
+		     CONFIG_APP_CHECKPOINT_MIN_ONTIME_S * MSEC_PER_SEC) ||
+		    (llabs(adc_energy_mwh(&counters[i]) - adc_energy_mwh(&saved)) >=
+		     CONFIG_APP_CHECKPOINT_MIN_ENERGY_MWH)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void checkpoint_work_handler(struct k_work *work)
+{
+	struct adc_counters counters[ADC_NUM_CHANNELS];
+	struct app_checkpoint checkpoint;
+
+	app_sensors_get_counters(counters);
+
+	for (size_t i = 0; i < ARRAY_SIZE(counters); i++) {
+		checkpoint.cumulative[i] = counters[i].total_cloud + counters[i].total_inflight +
+					   counters[i].total_unreported;
+		checkpoint.energy_acc[i] = counters[i].energy_acc;
+		checkpoint.charge_acc[i] = counters[i].charge_acc;
+	}
+
+	/* Small changes are left for a later checkpoint to save flash wear */
+	if (atomic_clear(&save_requested) || worth_saving(&checkpoint, counters)) {
+		save(&checkpoint);
+	}
+
+	k_work_schedule(&checkpoint_work, K_SECONDS(CONFIG_APP_CHECKPOINT_INTERVAL_S));
+}
+
+void app_checkpoint_start(void)
+{
+	k_work_schedule(&checkpoint_work, K_SECONDS(CONFIG_APP_CHECKPOINT_INTERVAL_S));
+}
+
+void app_checkpoint_request(void)
+{
+	atomic_set(&save_requested, 1);
+	k_work_reschedule(&checkpoint_work, K_NO_WAIT);
+}
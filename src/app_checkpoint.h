@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Local checkpoint of the cumulative on-time and energy counters.
+ *
+ * The totals are saved with the settings subsystem every
+ * CONFIG_APP_CHECKPOINT_INTERVAL_S, but only if they moved enough to be worth
+ * the flash write. Records alternate between two keys and carry a generation
+ * number and a CRC, so an interrupted or corrupted write falls back to the
+ * previous record instead of losing the totals.
+ */
+
+#ifndef __APP_CHECKPOINT_H__
+#define __APP_CHECKPOINT_H__
+
+#include <stdint.h>
+#include "app_sensors.h"
+
+struct app_checkpoint {
+	/** Cloud, in-flight and unreported on-time in milliseconds */
+	uint64_t cumulative[ADC_NUM_CHANNELS];
+	uint64_t energy_acc[ADC_NUM_CHANNELS];
+	int64_t charge_acc[ADC_NUM_CHANNELS];
+};
+
+/**
+ * @brief Read the newest valid checkpoint
+ *
+ * @return 0 on success, -ENOENT if no valid checkpoint is stored, or a
+ *         negative error code from the settings subsystem
+ */
+int app_checkpoint_load(struct app_checkpoint *out);
+
+/** @brief Start saving the counters periodically */
+void app_checkpoint_start(void);
+
+/** @brief Save the counters now, for example after they were reset */
+void app_checkpoint_request(void);
+
+#endif /* __APP_CHECKPOINT_H__ */
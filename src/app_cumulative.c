@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_cumulative, LOG_LEVEL_DBG);
+
+#include <ctype.h>
+#include <string.h>
+#include <golioth/client.h>
+#include <golioth/lightdb_state.h>
+#include <zcbor_decode.h>
+#include <zephyr/kernel.h>
+
+#include "app_cumulative.h"
+#include "app_event.h"
+#include "app_sensors.h"
+
+#define ADC_CUMULATIVE_ENDP "state/cumulative"
+
+enum fetch_state {
+	/* Waiting for the client to connect */
+	FETCH_IDLE,
+	/* Request sent; the timeout is scheduled on fetch_work */
+	FETCH_PENDING,
+	/* Request failed; the retry is scheduled on fetch_work */
+	FETCH_BACKOFF,
+	/* Totals loaded */
+	FETCH_DONE,
+};
+
+static struct golioth_client *client;
+
+static enum fetch_state state;
+/* Number of the outstanding request, passed to its response handler */
+static uint32_t fetch_seq;
+static uint32_t failures;
+static K_MUTEX_DEFINE(fetch_mutex);
+
+static void fetch_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(fetch_work, fetch_work_handler);
+
+/* Return the channel number of a "chN" key, or -EINVAL */
+static int parse_channel_key(const struct zcbor_string *key)
+{
+	int ch_num = 0;
+
+	if ((key->len < 3) || (key->len > 5) || (strncmp(key->value, "ch", 2) != 0)) {
+		return -EINVAL;
+	}
+
+	for (size_t i = 2; i < key->len; i++) {
+		if (!isdigit(key->value[i])) {
+			return -EINVAL;
+		}
+		ch_num = (ch_num * 10) + (key->value[i] - '0');
+	}
+
+	return ch_num;
+}
+
+static void get_cumulative_handler(struct golioth_client *client,
+				  const struct golioth_response *response,
+				  const char *path,
+				  const uint8_t *payload,
+				  size_t payload_size,
+				  void *arg)
+{
+	struct app_event event = {
+		.type = APP_EVENT_CUMULATIVE_LOADED,
+		.cumulative.seq = (uint32_t)(uintptr_t)arg,
+	};
+	struct zcbor_string key;
+	uint64_t data;
+	int ch_num;
+	bool ok;
+
+	if (response->status != GOLIOTH_OK) {
+		LOG_ERR("Failed to receive cumulative value: %d", response->status);
+		goto cumulative_failed;
+	}
+
+	if ((payload_size == 1) && (payload[0] == 0xf6)) {
+		/* 0xf6 is Null in CBOR; nothing stored yet, so every channel starts from zero */
+		event.cumulative.found = BIT_MASK(ADC_NUM_CHANNELS);
+		app_event_post(&event);
+		return;
+	}
+
+	ZCBOR_STATE_D(decoding_state, 1, payload, payload_size, 1, NULL);
+	ok = zcbor_map_start_decode(decoding_state);
+	if (!ok) {
+		goto cumulative_decode_error;
+	}
+
+	while (decoding_state->elem_count > 1) {
+		ok = zcbor_tstr_decode(decoding_state, &key) &&
+		     zcbor_uint64_decode(decoding_state, &data);
+		if (!ok) {
+			goto cumulative_decode_error;
+		}
+
+		ch_num = parse_channel_key(&key);
+		if ((ch_num < 0) || (ch_num >= ADC_NUM_CHANNELS)) {
+			continue;
+		}
+
+		event.cumulative.totals[ch_num] = data;
+		event.cumulative.found |= BIT(ch_num);
+	}
+
+	if (event.cumulative.found == 0) {
+		goto cumulative_decode_error;
+	}
+
+	/* Applied on the event thread */
+	app_event_post(&event);
+	return;
+
+cumulative_decode_error:
+	LOG_ERR("ZCBOR Decoding Error");
+	LOG_HEXDUMP_ERR(payload, payload_size, "cbor_payload");
+
+cumulative_failed:
+	event.type = APP_EVENT_CUMULATIVE_FAILED;
+	app_event_post(&event);
+}
+
+/* Log the totals kept on the device while the cloud totals are unknown */
+static void log_local_totals(void)
+{
+	struct adc_counters counters[ADC_NUM_CHANNELS];
+
+	app_sensors_get_counters(counters);
+
+	for (size_t i = 0; i < ARRAY_SIZE(counters); i++) {
+		LOG_INF("Local cumulative (ch%d): %llu", (int)i,
+			counters[i].total_cloud + counters[i].total_inflight +
+				counters[i].total_unreported);
+	}
+}
+
+/*
+ * Wait twice as long after each failure. The fetch is never abandoned: the
+ * local totals may be behind the cloud, so they are not written until the
+ * cloud totals have been merged. Caller must hold fetch_mutex.
+ */
+static void fetch_failed(void)
+{
+	uint32_t delay_s;
+
+	failures++;
+
+	if (failures >= CONFIG_APP_CUMULATIVE_FETCH_MAX_FAILURES) {
+		delay_s = CONFIG_APP_CUMULATIVE_FETCH_BACKOFF_MAX_S;
+		log_local_totals();
+	} else {
+		delay_s = MIN((uint64_t)CONFIG_APP_CUMULATIVE_FETCH_BACKOFF_MIN_S
+				      << MIN(failures - 1, 31),
+			      CONFIG_APP_CUMULATIVE_FETCH_BACKOFF_MAX_S);
+	}
+
+	LOG_WRN("Cumulative fetch failed %u times; retrying in %u s", failures, delay_s);
+
+	state = FETCH_BACKOFF;
+	k_work_reschedule(&fetch_work, K_SECONDS(delay_s));
+}
+
+static void fetch_work_handler(struct k_work *work)
+{
+	int err;
+
+	k_mutex_lock(&fetch_mutex, K_FOREVER);
+
+	switch (state) {
+	case FETCH_PENDING:
+		/* A response arriving after this is ignored */
+		LOG_WRN("No response to cumulative fetch %u", fetch_seq);
+		fetch_failed();
+		break;
+	case FETCH_IDLE:
+	case FETCH_BACKOFF:
+		if (!client || !golioth_client_is_connected(client)) {
+			/* Started again on connect */
+			state = FETCH_IDLE;
+			break;
+		}
+
+		fetch_seq++;
+
+		/* Get cumulative "on" time from Golioth LightDB State */
+		err = golioth_lightdb_get_async(client,
+						ADC_CUMULATIVE_ENDP,
+						GOLIOTH_CONTENT_TYPE_CBOR,
+						get_cumulative_handler,
+						(void *)(uintptr_t)fetch_seq);
+		if (err) {
+			LOG_WRN("failed to get cumulative channel data from LightDB: %d", err);
+			fetch_failed();
+			break;
+		}
+
+		state = FETCH_PENDING;
+		k_work_reschedule(&fetch_work, K_SECONDS(CONFIG_APP_CUMULATIVE_FETCH_TIMEOUT_S));
+		break;
+	default:
+		break;
+	}
+
+	k_mutex_unlock(&fetch_mutex);
+}
+
+void app_cumulative_set_client(struct golioth_client *cumulative_client)
+{
+	client = cumulative_client;
+}
+
+void app_cumulative_fetch(void)
+{
+	k_mutex_lock(&fetch_mutex, K_FOREVER);
+
+	if (state == FETCH_IDLE) {
+		/* Does nothing if the request is already scheduled */
+		k_work_schedule(&fetch_work, K_NO_WAIT);
+	}
+
+	k_mutex_unlock(&fetch_mutex);
+}
+
+void app_cumulative_loaded(uint32_t seq, const uint64_t *totals, uint32_t found)
+{
+	k_mutex_lock(&fetch_mutex, K_FOREVER);
+
+	if ((state != FETCH_PENDING) || (seq != fetch_seq)) {
+		k_mutex_unlock(&fetch_mutex);
+		LOG_DBG("Ignoring response to cumulative fetch %u", seq);
+		return;
+	}
+
+	state = FETCH_DONE;
+	failures = 0;
+	k_work_cancel_delayable(&fetch_work);
+
+	k_mutex_unlock(&fetch_mutex);
+
+	app_sensors_load_cumulative(totals, found);
+}
+
+void app_cumulative_failed(uint32_t seq)
+{
+	k_mutex_lock(&fetch_mutex, K_FOREVER);
+
+	if ((state == FETCH_PENDING) && (seq == fetch_seq)) {
+		fetch_failed();
+	}
+
+	k_mutex_unlock(&fetch_mutex);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Fetch of the cumulative on-time totals from LightDB State.
+ *
+ * Only one request is outstanding at a time. A request that fails or gets no
+ * response within CONFIG_APP_CUMULATIVE_FETCH_TIMEOUT_S is retried with
+ * exponential backoff, so a slow or lossy connection is not flooded with
+ * requests. After CONFIG_APP_CUMULATIVE_FETCH_MAX_FAILURES failures the fetch
+ * is retried every CONFIG_APP_CUMULATIVE_FETCH_BACKOFF_MAX_S and the local
+ * totals are only logged: the checkpoint they come from may be behind the
+ * cloud, so they are not written until the cloud totals have been merged. Once
+ * the totals are loaded they are kept on the device and are not fetched again.
+ */
+
+#ifndef __APP_CUMULATIVE_H__
+#define __APP_CUMULATIVE_H__
+
+#include <stdint.h>
+#include <golioth/client.h>
+
+void app_cumulative_set_client(struct golioth_client *cumulative_client);
+
+/**
+ * @brief Start fetching the totals unless a fetch is running or waiting to retry
+ *
+ * Does nothing once the totals are loaded. Safe to call on every report.
+ */
+void app_cumulative_fetch(void);
+
+/**
+ * @brief Apply totals received from LightDB State
+ *
+ * @param seq Number of the request the totals answer; stale answers are ignored
+ * @param totals Array of ADC_NUM_CHANNELS totals, indexed by channel number
+ * @param found Bit per channel present in @p totals
+ */
+void app_cumulative_loaded(uint32_t seq, const uint64_t *totals, uint32_t found);
+
+/**
+ * @brief Schedule a retry after a failed request
+ *
+ * @param seq Number of the request that failed; stale failures are ignored
+ */
+void app_cumulative_failed(uint32_t seq);
+
+#endif /* __APP_CUMULATIVE_H__ */
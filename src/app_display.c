@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_display, LOG_LEVEL_DBG);
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+
+#include "app_display.h"
+#include "app_sampler.h"
+#include "app_sensors.h"
+
+#include <drivers/sensor/ina260.h>
+
+#ifdef CONFIG_LIB_OSTENTUS
+#include <libostentus.h>
+static const struct device *o_dev = DEVICE_DT_GET_ANY(golioth_ostentus);
+#endif
+
+/* Integer arithmetic only; raw current and voltage LSBs are 1.25 mA and 1.25 mV */
+#define RAW_TO_MICRO(raw) ((raw) * INA260_UNITS_PER_BIT_MICRO)
+#define RAW_TO_MW(raw) ((raw) * 10)
+
+static void log_work_handler(struct k_work *work)
+{
+	struct app_sample sample;
+
+	for (uint8_t ch = 0; ch < ADC_NUM_CHANNELS; ch++) {
+		if (app_sampler_latest(ch, &sample) != 0) {
+			continue;
+		}
+
+		LOG_INF("ch%d: %d mV, %d mA, %d mW", ch,
+			RAW_TO_MICRO(sample.raw.voltage) / 1000,
+			RAW_TO_MICRO(sample.raw.current) / 1000,
+			RAW_TO_MW(sample.raw.power));
+	}
+
+	k_work_schedule(k_work_delayable_from_work(work), K_SECONDS(CONFIG_APP_LOG_INTERVAL_S));
+}
+
+static K_WORK_DELAYABLE_DEFINE(log_work, log_work_handler);
+
+#ifdef CONFIG_LIB_OSTENTUS
+/* Format a value given in hundredths with two decimal places */
+static void format_centi(char *buf, size_t len, int32_t centi, const char *unit)
+{
+	snprintk(buf, len, "%s%d.%02d %s", (centi < 0) ? "-" : "", abs(centi) / 100,
+		 abs(centi) % 100, unit);
+}
+
+static void show_channel(uint8_t ch_num, const vcp_raw_t *raw)
+{
+	char ostentus_buf[32];
+
+	format_centi(ostentus_buf, sizeof(ostentus_buf), RAW_TO_MICRO(raw->voltage) / 10000, "V");
+	ostentus_slide_set(o_dev, CH_SLIDE(ch_num, VCP_VOLTAGE), ostentus_buf,
+			   strlen(ostentus_buf));
+
+	format_centi(ostentus_buf, sizeof(ostentus_buf), RAW_TO_MICRO(raw->current) / 10, "mA");
+	ostentus_slide_set(o_dev, CH_SLIDE(ch_num, VCP_CURRENT), ostentus_buf,
+			   strlen(ostentus_buf));
+
+	format_centi(ostentus_buf, sizeof(ostentus_buf), RAW_TO_MW(raw->power) / 10, "W");
+	ostentus_slide_set(o_dev, CH_SLIDE(ch_num, VCP_POWER), ostentus_buf,
+			   strlen(ostentus_buf));
+}
+
+static void display_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct app_sample sample;
+
+	while (true) {
+		for (uint8_t ch = 0; ch < ADC_NUM_CHANNELS; ch++) {
+			if (app_sampler_latest(ch, &sample) == 0) {
+				show_channel(ch, &sample.raw);
+			}
+		}
+
+		k_sleep(K_SECONDS(CONFIG_APP_DISPLAY_INTERVAL_S));
+	}
+}
+
+/* Started by app_display_start() once the slides exist */
+K_THREAD_DEFINE(display_tid, CONFIG_APP_DISPLAY_STACK_SIZE, display_thread, NULL, NULL, NULL,
+		CONFIG_APP_DISPLAY_THREAD_PRIORITY, 0, SYS_FOREVER_MS);
+#endif /* CONFIG_LIB_OSTENTUS */
+
+void app_display_start(void)
+{
+	if (CONFIG_APP_LOG_INTERVAL_S > 0) {
+		k_work_schedule(&log_work, K_SECONDS(CONFIG_APP_LOG_INTERVAL_S));
+	}
+
+	IF_ENABLED(CONFIG_LIB_OSTENTUS, (k_thread_start(display_tid);));
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Local output of the latest readings.
+ *
+ * Readings are logged every CONFIG_APP_LOG_INTERVAL_S seconds and shown on
+ * the Ostentus every CONFIG_APP_DISPLAY_INTERVAL_S seconds, each on its own
+ * schedule so that a slow display never delays sampling or reporting.
+ */
+
+#ifndef __APP_DISPLAY_H__
+#define __APP_DISPLAY_H__
+
+/**
+ * @brief Start logging and displaying readings
+ *
+ * Call after the Ostentus slides have been added.
+ */
+void app_display_start(void);
+
+#endif /* __APP_DISPLAY_H__ */
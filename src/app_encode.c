@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_encode, LOG_LEVEL_DBG);
+
+#include <string.h>
+#include <zcbor_encode.h>
+#include <zephyr/kernel.h>
+
+#include "app_encode.h"
+#include "app_store.h"
+
+/* Deepest nesting is report map -> quantity map -> channel map */
+#define REPORT_BACKUPS 4
+#define STATE_BACKUPS  3
+
+#ifdef CONFIG_ASSERT
+/*
+ * Encoders write here first so a worst-case size that is too small trips an
+ * assertion; encoding straight into a buffer of that size would just fail.
+ */
+#define CHECK_SLACK 64
+#define CHECK_BUF_SIZE								\
+	(MAX(MAX(APP_ENCODE_REPORT_MAX_SIZE, APP_ENCODE_STATE_MAX_SIZE),	\
+	     MAX(APP_ENCODE_BATTERY_MAX_SIZE, APP_ENCODE_EVENT_MAX_SIZE)) + CHECK_SLACK)
+
+static uint8_t check_buf[CHECK_BUF_SIZE];
+static K_MUTEX_DEFINE(check_mutex);
+#endif
+
+/* Buffer an encoder writes to */
+struct encode_target {
+	uint8_t *data;
+	size_t size;
+};
+
+static struct encode_target encode_begin(uint8_t *buf, size_t size)
+{
+#ifdef CONFIG_ASSERT
+	k_mutex_lock(&check_mutex, K_FOREVER);
+	return (struct encode_target){ .data = check_buf, .size = sizeof(check_buf) };
+#else
+	return (struct encode_target){ .data = buf, .size = size };
+#endif
+}
+
+/* Check the encoded length against the worst case and hand the payload to the caller */
+static int encode_end(uint8_t *buf, size_t size, int len, size_t max_size, const char *max_name)
+{
+#ifdef CONFIG_ASSERT
+	/* A negative length means the payload overflowed the slack as well */
+	__ASSERT((len >= 0) && (len <= max_size), "%s is too small", max_name);
+
+	if (len > (int)size) {
+		len = -ENOMEM;
+	} else if (len > 0) {
+		memcpy(buf, check_buf, len);
+	}
+
+	k_mutex_unlock(&check_mutex);
+#endif
+
+	return len;
+}
+
+#define ENCODE_END(buf, size, len, max_size) encode_end(buf, size, len, max_size, #max_size)
+
+static bool put_channel_key(zcbor_state_t *zse, size_t ch_num)
+{
+	char key[8];
+	int len = snprintk(key, sizeof(key), "ch%d", (int)ch_num);
+
+	return zcbor_tstr_encode_ptr(zse, key, len);
+}
+
+static bool encode_summary(zcbor_state_t *zse, const struct vcp_summary *summary)
+{
+	return zcbor_map_start_encode(zse, 4) &&
+	       zcbor_tstr_put_lit(zse, "min") &&
+	       zcbor_int32_put(zse, summary->min) &&
+	       zcbor_tstr_put_lit(zse, "max") &&
+	       zcbor_int32_put(zse, summary->max) &&
+	       zcbor_tstr_put_lit(zse, "mean") &&
+	       zcbor_int32_put(zse, summary->mean) &&
+	       zcbor_tstr_put_lit(zse, "rms") &&
+	       zcbor_uint32_put(zse, summary->rms) &&
+	       zcbor_map_end_encode(zse, 4);
+}
+
+/* Encode one quantity (selected by offset into struct vcp_report) for every channel */
+static bool encode_quantity(zcbor_state_t *zse, const char *name,
+			    const struct vcp_report *reports, size_t count, size_t offset)
+{
+	bool ok;
+
+	ok = zcbor_tstr_encode_ptr(zse, name, strlen(name)) &&
+	     zcbor_map_start_encode(zse, count);
+
+	for (size_t i = 0; ok && (i < count); i++) {
+		if (reports[i].count == 0) {
+			continue;
+		}
+
+		ok = put_channel_key(zse, i) &&
+		     encode_summary(zse, (const struct vcp_summary *)((const uint8_t *)&reports[i] +
+								       offset));
+	}
+
+	return ok && zcbor_map_end_encode(zse, count);
+}
+
+/* Encode a map of one 64-bit value per channel */
+static bool encode_channel_u64(zcbor_state_t *zse, const char *name, const uint64_t *values,
+			       size_t count)
+{
+	bool ok;
+
+	ok = zcbor_tstr_encode_ptr(zse, name, strlen(name)) &&
+	     zcbor_map_start_encode(zse, count);
+
+	for (size_t i = 0; ok && (i < count); i++) {
+		ok = put_channel_key(zse, i) && zcbor_uint64_put(zse, values[i]);
+	}
+
+	return ok && zcbor_map_end_encode(zse, count);
+}
+
+static bool encode_channel_i64(zcbor_state_t *zse, const char *name, const int64_t *values,
+			       size_t count)
+{
+	bool ok;
+
+	ok = zcbor_tstr_encode_ptr(zse, name, strlen(name)) &&
+	     zcbor_map_start_encode(zse, count);
+
+	for (size_t i = 0; ok && (i < count); i++) {
+		ok = put_channel_key(zse, i) && zcbor_int64_put(zse, values[i]);
+	}
+
+	return ok && zcbor_map_end_encode(zse, count);
+}
+
+bool app_encode_age(zcbor_state_t *zse, const uint8_t *start, int *age_offset)
+{
+	/* Values from 2^16 up are always encoded in four bytes after the header */
+	BUILD_ASSERT(APP_STORE_AGE_UNKNOWN > UINT16_MAX);
+
+	if (!zcbor_tstr_put_lit(zse, "age") || !zcbor_uint32_put(zse, APP_STORE_AGE_UNKNOWN)) {
+		return false;
+	}
+
+	*age_offset = zse->payload - start - APP_STORE_AGE_SIZE;
+	return true;
+}
+
+static bool encode_report_map(zcbor_state_t *zse, const struct vcp_report *reports, size_t count,
+			      const int64_t *t, const uint8_t *start, int *age_offset)
+{
+	/* Only the age and the timestamp are optional */
+	size_t entries = 4 + (age_offset ? 1 : 0) + (t ? 1 : 0);
+	bool ok;
+
+	ok = zcbor_map_start_encode(zse, entries);
+
+	if (ok && age_offset) {
+		ok = app_encode_age(zse, start, age_offset);
+	}
+
+	if (ok && t) {
+		ok = zcbor_tstr_put_lit(zse, "t") && zcbor_int64_put(zse, *t);
+	}
+
+	ok = ok &&
+	     encode_quantity(zse, "cur", reports, count, offsetof(struct vcp_report, cur)) &&
+	     encode_quantity(zse, "vol", reports, count, offsetof(struct vcp_report, vol)) &&
+	     encode_quantity(zse, "pow", reports, count, offsetof(struct vcp_report, pow)) &&
+	     zcbor_tstr_put_lit(zse, "n") &&
+	     zcbor_map_start_encode(zse, count);
+
+	for (size_t i = 0; ok && (i < count); i++) {
+		if (reports[i].count == 0) {
+			continue;
+		}
+
+		ok = put_channel_key(zse, i) && zcbor_uint32_put(zse, reports[i].count);
+	}
+
+	return ok && zcbor_map_end_encode(zse, count) && zcbor_map_end_encode(zse, entries);
+}
+
+bool app_encode_report_map(zcbor_state_t *zse, const struct vcp_report *reports, size_t count,
+			   const int64_t *t)
+{
+	return encode_report_map(zse, reports, count, t, NULL, NULL);
+}
+
+int app_encode_report(uint8_t *buf, size_t size, const struct vcp_report *reports, size_t count,
+		      int *age_offset)
+{
+	struct encode_target out = encode_begin(buf, size);
+	int len = -ENOMEM;
+
+	ZCBOR_STATE_E(zse, REPORT_BACKUPS, out.data, out.size, 1);
+
+	if (!encode_report_map(zse, reports, count, NULL, out.data, age_offset)) {
+		LOG_ERR("Failed to encode sensor report: %d", zcbor_peek_error(zse));
+	} else {
+		len = zse->payload - out.data;
+	}
+
+	return ENCODE_END(buf, size, len, APP_ENCODE_REPORT_MAX_SIZE);
+}
+
+int app_encode_state(uint8_t *buf, size_t size, const struct app_state_report *state)
+{
+	struct encode_target out = encode_begin(buf, size);
+	int len = -ENOMEM;
+	bool ok;
+
+	ZCBOR_STATE_E(zse, STATE_BACKUPS, out.data, out.size, 1);
+
+	ok = zcbor_map_start_encode(zse, 5) &&
+	     encode_channel_u64(zse, "live_runtime", state->live_runtime, ADC_NUM_CHANNELS);
+
+	if (ok && state->has_energy) {
+		ok = encode_channel_i64(zse, "energy_mwh", state->energy_mwh, ADC_NUM_CHANNELS) &&
+		     encode_channel_i64(zse, "charge_mah", state->charge_mah, ADC_NUM_CHANNELS);
+	}
+
+	if (ok && state->has_cumulative) {
+		ok = encode_channel_u64(zse, "cumulative", state->cumulative, ADC_NUM_CHANNELS) &&
+		     zcbor_tstr_put_lit(zse, "cumulative_seq") &&
+		     zcbor_uint32_put(zse, state->seq);
+	}
+
+	if (!ok || !zcbor_map_end_encode(zse, 5)) {
+		LOG_ERR("Failed to encode state: %d", zcbor_peek_error(zse));
+	} else {
+		len = zse->payload - out.data;
+	}
+
+	return ENCODE_END(buf, size, len, APP_ENCODE_STATE_MAX_SIZE);
+}
+
+int app_encode_battery(uint8_t *buf, size_t size, int voltage_mv, unsigned int level_pptt,
+		       int *age_offset)
+{
+	struct encode_target out = encode_begin(buf, size);
+	int len = -ENOMEM;
+	bool ok;
+
+	ZCBOR_STATE_E(zse, 1, out.data, out.size, 1);
+
+	ok = zcbor_map_start_encode(zse, 3) &&
+	     app_encode_age(zse, out.data, age_offset) &&
+	     zcbor_tstr_put_lit(zse, "batt_v") &&
+	     zcbor_float32_put(zse, voltage_mv / 1000.0f) &&
+	     zcbor_tstr_put_lit(zse, "batt_lvl") &&
+	     zcbor_float32_put(zse, level_pptt / 100.0f) &&
+	     zcbor_map_end_encode(zse, 3);
+
+	if (!ok) {
+		LOG_ERR("Failed to encode battery data: %d", zcbor_peek_error(zse));
+	} else {
+		len = zse->payload - out.data;
+	}
+
+	return ENCODE_END(buf, size, len, APP_ENCODE_BATTERY_MAX_SIZE);
+}
+
+int app_encode_event(uint8_t *buf, size_t size, const struct app_alert_event *event,
+		     int *age_offset)
+{
+	struct encode_target out = encode_begin(buf, size);
+	int len = -ENOMEM;
+	bool ok;
+
+	ZCBOR_STATE_E(zse, 1, out.data, out.size, 1);
+
+	ok = zcbor_map_start_encode(zse, 9) &&
+	     app_encode_age(zse, out.data, age_offset) &&
+	     zcbor_tstr_put_lit(zse, "ch") &&
+	     zcbor_uint32_put(zse, event->ch_num) &&
+	     zcbor_tstr_put_lit(zse, "type") &&
+	     zcbor_tstr_encode_ptr(zse, event->func, strlen(event->func)) &&
+	     zcbor_tstr_put_lit(zse, "limit") &&
+	     zcbor_int32_put(zse, event->limit) &&
+	     zcbor_tstr_put_lit(zse, "suppressed") &&
+	     zcbor_uint32_put(zse, event->suppressed);
+
+	if (ok && event->has_sample) {
+		ok = zcbor_tstr_put_lit(zse, "uptime") &&
+		     zcbor_int64_put(zse, event->ts) &&
+		     zcbor_tstr_put_lit(zse, "cur") &&
+		     zcbor_int32_put(zse, event->raw.current) &&
+		     zcbor_tstr_put_lit(zse, "vol") &&
+		     zcbor_int32_put(zse, event->raw.voltage) &&
+		     zcbor_tstr_put_lit(zse, "pow") &&
+		     zcbor_uint32_put(zse, event->raw.power);
+	}
+
+	if (!ok || !zcbor_map_end_encode(zse, 9)) {
+		LOG_ERR("Failed to encode alert event: %d", zcbor_peek_error(zse));
+	} else {
+		len = zse->payload - out.data;
+	}
+
+	return ENCODE_END(buf, size, len, APP_ENCODE_EVENT_MAX_SIZE);
+}
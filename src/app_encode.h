@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * CBOR encoding of all telemetry sent to Golioth.
+ *
+ * Every payload has a fixed worst-case size, given by the `*_MAX_SIZE` macros
+ * below, so callers can use preallocated buffers of that size. Builds with
+ * CONFIG_ASSERT encode into a larger scratch buffer first and assert that the
+ * payload fits the estimate.
+ */
+
+#ifndef __APP_ENCODE_H__
+#define __APP_ENCODE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zcbor_encode.h>
+#include "app_sensors.h"
+
+/** Worst-case size of an "age" entry, see app_encode_age() */
+#define APP_ENCODE_AGE_MAX_SIZE 9
+
+/** Worst-case size of one sensor report, including the optional timestamp */
+#define APP_ENCODE_REPORT_MAX_SIZE (40 + APP_ENCODE_AGE_MAX_SIZE + (150 * ADC_NUM_CHANNELS))
+
+/** Worst-case size of the device state */
+#define APP_ENCODE_STATE_MAX_SIZE (88 + (56 * ADC_NUM_CHANNELS))
+
+/** Worst-case size of a battery reading */
+#define APP_ENCODE_BATTERY_MAX_SIZE (32 + APP_ENCODE_AGE_MAX_SIZE)
+
+/** Worst-case size of an alert event */
+#define APP_ENCODE_EVENT_MAX_SIZE (96 + APP_ENCODE_AGE_MAX_SIZE)
+
+/** Device state reported to LightDB State, indexed by channel number */
+struct app_state_report {
+	uint64_t live_runtime[ADC_NUM_CHANNELS];
+	int64_t energy_mwh[ADC_NUM_CHANNELS];
+	int64_t charge_mah[ADC_NUM_CHANNELS];
+	uint64_t cumulative[ADC_NUM_CHANNELS];
+	/* Sequence number of the write, sent with the cumulative totals */
+	uint32_t seq;
+	bool has_energy;
+	bool has_cumulative;
+};
+
+/** Limit alert on one channel */
+struct app_alert_event {
+	uint8_t ch_num;
+	const char *func;
+	int32_t limit;
+	/* Alerts not reported separately since the previous event */
+	uint32_t suppressed;
+	/* Most recent sample; uptime in milliseconds */
+	bool has_sample;
+	int64_t ts;
+	vcp_raw_t raw;
+};
+
+/**
+ * @brief Encode an "age" map entry for the store to fill in when sending
+ *
+ * The value is a placeholder of APP_STORE_AGE_SIZE bytes; see app_store.h.
+ *
+ * @param zse zcbor encoding state, inside a map
+ * @param start Start of the payload being encoded
+ * @param age_offset Set to the offset of the placeholder from @p start
+ *
+ * @return true on success
+ */
+bool app_encode_age(zcbor_state_t *zse, const uint8_t *start, int *age_offset);
+
+/**
+ * @brief Encode a sensor report as a CBOR map into an existing zcbor state
+ *
+ * Channels with no samples are left out.
+ *
+ * @param zse zcbor encoding state with at least 3 backups
+ * @param reports Summary of each channel, indexed by channel number
+ * @param count Number of entries in @p reports
+ * @param t Optional relative timestamp in milliseconds, or NULL to omit it
+ *
+ * @return true on success
+ */
+bool app_encode_report_map(zcbor_state_t *zse, const struct vcp_report *reports, size_t count,
+			   const int64_t *t);
+
+/**
+ * @brief Encode a sensor report with an "age" entry
+ *
+ * @param age_offset Set to the offset of the age slot in @p buf
+ *
+ * @return Encoded length on success, or a negative error code
+ */
+int app_encode_report(uint8_t *buf, size_t size, const struct vcp_report *reports, size_t count,
+		      int *age_offset);
+
+/**
+ * @brief Encode the device state
+ *
+ * @return Encoded length on success, or a negative error code
+ */
+int app_encode_state(uint8_t *buf, size_t size, const struct app_state_report *state);
+
+/**
+ * @brief Encode a battery reading with an "age" entry
+ *
+ * @param voltage_mv Battery voltage in millivolts
+ * @param level_pptt Battery level in parts per ten thousand
+ * @param age_offset Set to the offset of the age slot in @p buf
+ *
+ * @return Encoded length on success, or a negative error code
+ */
+int app_encode_battery(uint8_t *buf, size_t size, int voltage_mv, unsigned int level_pptt,
+		       int *age_offset);
+
+/**
+ * @brief Encode a limit alert event with an "age" entry
+ *
+ * @param age_offset Set to the offset of the age slot in @p buf
+ *
+ * @return Encoded length on success, or a negative error code
+ */
+int app_encode_event(uint8_t *buf, size_t size, const struct app_alert_event *event,
+		     int *age_offset);
+
+#endif /* __APP_ENCODE_H__ */
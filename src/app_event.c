@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_event, LOG_LEVEL_DBG);
+
+#include <zephyr/kernel.h>
+
+#include "app_cumulative.h"
+#include "app_event.h"
+#include "app_sensors.h"
+#include "app_settings.h"
+#include "app_state.h"
+
+K_MSGQ_DEFINE(event_msgq, sizeof(struct app_event), CONFIG_APP_EVENT_QUEUE_SIZE, 8);
+
+int app_event_post(const struct app_event *event)
+{
+	int err = k_msgq_put(&event_msgq, event, K_NO_WAIT);
+
+	if (err) {
+		LOG_ERR("Event queue full; dropped event %d", event->type);
+		return -ENOMSG;
+	}
+
+	return 0;
+}
+
+static void handle_event(const struct app_event *event)
+{
+	switch (event->type) {
+	case APP_EVENT_CUMULATIVE_LOADED:
+		app_cumulative_loaded(event->cumulative.seq, event->cumulative.totals,
+				      event->cumulative.found);
+		break;
+	case APP_EVENT_CUMULATIVE_FAILED:
+		app_cumulative_failed(event->cumulative.seq);
+		break;
+	case APP_EVENT_RESET_CUMULATIVE:
+		reset_cumulative_totals();
+		app_state_reset_desired();
+		break;
+	case APP_EVENT_CLEAR_DESIRED:
+		app_state_reset_desired();
+		break;
+	case APP_EVENT_CONNECTED:
+		/* Totals must be fetched before any unreported time can be added to them */
+		app_cumulative_fetch();
+		app_state_update_actual();
+		app_sensors_request_flush();
+		break;
+	case APP_EVENT_STATE_ACK:
+		app_sensors_report_done(event->state_ack.seq, event->state_ack.acked);
+		if (!event->state_ack.acked) {
+			/* Resend with the next report even if nothing changed */
+			app_state_update_actual();
+		}
+		break;
+	case APP_EVENT_SAVE_SETTING:
+		app_settings_save(event->setting.index, event->setting.value);
+		break;
+	default:
+		LOG_WRN("Unknown event %d", event->type);
+		break;
+	}
+}
+
+static void event_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct app_event event;
+
+	while (true) {
+		k_msgq_get(&event_msgq, &event, K_FOREVER);
+		handle_event(&event);
+	}
+}
+
+K_THREAD_DEFINE(app_event_tid, CONFIG_APP_EVENT_STACK_SIZE, event_thread, NULL, NULL, NULL,
+		CONFIG_APP_EVENT_THREAD_PRIORITY, 0, 0);
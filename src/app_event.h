@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Application event thread.
+ *
+ * Golioth response callbacks run on the client thread. They only decode what
+ * they received and post an event here; anything that takes locks or makes
+ * further Golioth requests is done on the event thread, so CoAP processing is
+ * never held up by the application.
+ */
+
+#ifndef __APP_EVENT_H__
+#define __APP_EVENT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "app_sensors.h"
+
+enum app_event_type {
+	/** Cumulative totals were received from LightDB State */
+	APP_EVENT_CUMULATIVE_LOADED,
+	/** Cumulative totals could not be fetched or decoded */
+	APP_EVENT_CUMULATIVE_FAILED,
+	/** The cloud asked for the cumulative totals to be reset */
+	APP_EVENT_RESET_CUMULATIVE,
+	/** The desired state could not be decoded and should be cleared */
+	APP_EVENT_CLEAR_DESIRED,
+	/** The Golioth client (re)connected; send what was buffered offline */
+	APP_EVENT_CONNECTED,
+	/** A state write carrying on-time completed */
+	APP_EVENT_STATE_ACK,
+	/** A value from the Settings service was accepted and should be saved */
+	APP_EVENT_SAVE_SETTING,
+};
+
+struct app_event {
+	enum app_event_type type;
+	union {
+		/** APP_EVENT_CUMULATIVE_LOADED and APP_EVENT_CUMULATIVE_FAILED */
+		struct {
+			/** Number of the request answered */
+			uint32_t seq;
+			uint64_t totals[ADC_NUM_CHANNELS];
+			/** Bit per channel present in @p totals; others start from zero */
+			uint32_t found;
+		} cumulative;
+		/** APP_EVENT_STATE_ACK */
+		struct {
+			uint32_t seq;
+			bool acked;
+		} state_ack;
+		/** APP_EVENT_SAVE_SETTING */
+		struct {
+			uint16_t index;
+			int32_t value;
+		} setting;
+	};
+};
+
+/**
+ * @brief Queue an event for the event thread without blocking
+ *
+ * Safe to call from Golioth callbacks.
+ *
+ * @return 0 on success, or -ENOMSG if the queue is full
+ */
+int app_event_post(const struct app_event *event);
+
+#endif /* __APP_EVENT_H__ */
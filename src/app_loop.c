@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_loop, LOG_LEVEL_DBG);
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+
+#include "app_loop.h"
+
+/* Uptime in ticks at which the current iteration was due, or -1 to realign */
+static int64_t deadline = -1;
+static int32_t deadline_period_s;
+/* Uptime in ticks when the last sleep ended, or -1 before the first one */
+static int64_t woke = -1;
+
+static struct {
+	uint32_t iterations;
+	uint32_t missed;
+	uint32_t jitter_min_us;
+	uint32_t jitter_max_us;
+	uint64_t jitter_sum_us;
+	uint32_t busy_max_us;
+} stats = {
+	.jitter_min_us = UINT32_MAX,
+};
+static struct k_spinlock stats_lock;
+
+static uint32_t ticks_to_us(int64_t ticks)
+{
+	return (uint32_t)MIN(k_ticks_to_us_floor64(ticks), UINT32_MAX);
+}
+
+static void record_busy(int64_t busy)
+{
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+	stats.busy_max_us = MAX(stats.busy_max_us, ticks_to_us(busy));
+
+	k_spin_unlock(&stats_lock, key);
+}
+
+static void record_missed(uint32_t missed)
+{
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+	stats.missed += missed;
+
+	k_spin_unlock(&stats_lock, key);
+}
+
+static void record_jitter(int64_t late)
+{
+	uint32_t late_us = ticks_to_us(late);
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+	stats.iterations++;
+	stats.jitter_min_us = MIN(stats.jitter_min_us, late_us);
+	stats.jitter_max_us = MAX(stats.jitter_max_us, late_us);
+	stats.jitter_sum_us += late_us;
+
+	k_spin_unlock(&stats_lock, key);
+}
+
+void app_loop_wait(int32_t period_s)
+{
+	int64_t now = k_uptime_ticks();
+	int64_t period;
+	uint32_t missed = 0;
+
+	if (period_s <= 0) {
+		deadline = -1;
+		woke = -1;
+		k_yield();
+		return;
+	}
+
+	if (woke >= 0) {
+		/* Time the loop body ran, from waking up until now */
+		record_busy(now - woke);
+	}
+
+	period = (int64_t)period_s * CONFIG_SYS_CLOCK_TICKS_PER_SEC;
+
+	if ((deadline < 0) || (period_s != deadline_period_s)) {
+		/* Start on the next multiple of the period */
+		deadline = now - (now % period) + period;
+		deadline_period_s = period_s;
+	} else {
+		deadline += period;
+		if (deadline <= now) {
+			/* Overran; skip to the next deadline still ahead rather than bunching up */
+			missed = ((now - deadline) / period) + 1;
+			deadline += missed * period;
+
+			LOG_WRN("Loop overran; skipped %u period(s)", missed);
+			record_missed(missed);
+		}
+	}
+
+	if (k_sleep(K_TIMEOUT_ABS_TICKS(deadline)) > 0) {
+		/* Woken early, e.g. after a new loop delay; realign on the next call */
+		woke = k_uptime_ticks();
+		deadline = -1;
+		return;
+	}
+
+	woke = k_uptime_ticks();
+	record_jitter(woke - deadline);
+}
+
+void app_loop_get_stats(struct app_loop_stats *out, bool reset)
+{
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+	out->period_s = deadline_period_s;
+	out->iterations = stats.iterations;
+	out->missed = stats.missed;
+	out->jitter_min_us = stats.iterations ? stats.jitter_min_us : 0;
+	out->jitter_max_us = stats.jitter_max_us;
+	out->jitter_mean_us = stats.iterations ? (stats.jitter_sum_us / stats.iterations) : 0;
+	out->busy_max_us = stats.busy_max_us;
+
+	if (reset) {
+		memset(&stats, 0, sizeof(stats));
+		stats.jitter_min_us = UINT32_MAX;
+	}
+
+	k_spin_unlock(&stats_lock, key);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Fixed-rate scheduling of the main loop.
+ *
+ * Iterations start on multiples of the loop period in system uptime, so the
+ * time spent reporting does not add to the period. How late each iteration
+ * starts is recorded so the cadence can be checked with the `get_loop_stats`
+ * RPC.
+ */
+
+#ifndef __APP_LOOP_H__
+#define __APP_LOOP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct app_loop_stats {
+	/** Loop period in seconds */
+	uint32_t period_s;
+	/** Iterations started on time or late, since the last reset */
+	uint32_t iterations;
+	/** Deadlines skipped because an iteration ran past the next one */
+	uint32_t missed;
+	/** Time from a deadline to the start of its iteration */
+	uint32_t jitter_min_us;
+	uint32_t jitter_max_us;
+	uint32_t jitter_mean_us;
+	/** Longest time from waking up to going back to sleep */
+	uint32_t busy_max_us;
+};
+
+/**
+ * @brief Sleep until the start of the next loop period
+ *
+ * If the sleep is cut short with k_wakeup(), for example because the period
+ * was changed, this returns early and the next call aligns to the new period.
+ *
+ * @param period_s Loop period in seconds; 0 only yields
+ */
+void app_loop_wait(int32_t period_s);
+
+/**
+ * @brief Get the loop timing statistics
+ *
+ * @param reset Start a new measurement after copying the statistics
+ */
+void app_loop_get_stats(struct app_loop_stats *out, bool reset);
+
+#endif /* __APP_LOOP_H__ */
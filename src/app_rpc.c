@@ -13,6 +13,7 @@ LOG_MODULE_REGISTER(app_rpc, LOG_LEVEL_DBG);
 #include <zephyr/sys/reboot.h>
 
 #include <network_info.h>
+#include "app_loop.h"
 #include "app_rpc.h"
 
 static void reboot_work_handler(struct k_work *work)
@@ -85,6 +86,46 @@ static enum golioth_rpc_status on_set_log_level(zcbor_state_t *request_params_ar
 	return GOLIOTH_RPC_OK;
 }
 
+static enum golioth_rpc_status on_get_loop_stats(zcbor_state_t *request_params_array,
+						 zcbor_state_t *response_detail_map,
+						 void *callback_arg)
+{
+	struct app_loop_stats stats;
+	bool reset = false;
+	bool ok;
+
+	/* Optional parameter: true to start a new measurement */
+	if (!zcbor_array_at_end(request_params_array)) {
+		ok = zcbor_bool_decode(request_params_array, &reset);
+		if (!ok) {
+			LOG_ERR("Failed to decode array item");
+			return GOLIOTH_RPC_INVALID_ARGUMENT;
+		}
+	}
+
+	app_loop_get_stats(&stats, reset);
+
+	ok = zcbor_tstr_put_lit(response_detail_map, "period_s") &&
+	     zcbor_uint32_put(response_detail_map, stats.period_s) &&
+	     zcbor_tstr_put_lit(response_detail_map, "iterations") &&
+	     zcbor_uint32_put(response_detail_map, stats.iterations) &&
+	     zcbor_tstr_put_lit(response_detail_map, "missed") &&
+	     zcbor_uint32_put(response_detail_map, stats.missed) &&
+	     zcbor_tstr_put_lit(response_detail_map, "jitter_min_us") &&
+	     zcbor_uint32_put(response_detail_map, stats.jitter_min_us) &&
+	     zcbor_tstr_put_lit(response_detail_map, "jitter_max_us") &&
+	     zcbor_uint32_put(response_detail_map, stats.jitter_max_us) &&
+	     zcbor_tstr_put_lit(response_detail_map, "jitter_mean_us") &&
+	     zcbor_uint32_put(response_detail_map, stats.jitter_mean_us) &&
+	     zcbor_tstr_put_lit(response_detail_map, "busy_max_us") &&
+	     zcbor_uint32_put(response_detail_map, stats.busy_max_us);
+	if (!ok) {
+		return GOLIOTH_RPC_RESOURCE_EXHAUSTED;
+	}
+
+	return GOLIOTH_RPC_OK;
+}
+
 static enum golioth_rpc_status on_reboot(zcbor_state_t *request_params_array,
 					 zcbor_state_t *response_detail_map,
 					 void *callback_arg)
@@ -111,6 +152,9 @@ void app_rpc_register(struct golioth_client *client)
 	err = golioth_rpc_register(rpc, "get_network_info", on_get_network_info, NULL);
 	rpc_log_if_register_failure(err);
 
+	err = golioth_rpc_register(rpc, "get_loop_stats", on_get_loop_stats, NULL);
+	rpc_log_if_register_failure(err);
+
 	err = golioth_rpc_register(rpc, "reboot", on_reboot, NULL);
 	rpc_log_if_register_failure(err);
 
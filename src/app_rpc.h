@@ -10,6 +10,8 @@
  *
  * This demonstration implements the following RPCs:
  * - `get_network_info`: Query and return network information.
+ * - `get_loop_stats`: return main loop timing statistics (optional argument:
+ *   true to reset them)
  * - `reboot`: reboot the device (no arguments)
  * - `set_log_level`: adjust the logging level for all registered modules (valid
  *   argument values: 0..4)
@@ -0,0 +1,521 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_sampler, LOG_LEVEL_DBG);
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/atomic.h>
+
+#include "app_sampler.h"
+
+#include <drivers/sensor/ina260.h>
+
+#define SAMPLE_PERIOD_US (USEC_PER_SEC / CONFIG_APP_SAMPLER_RATE_HZ)
+
+struct sample_ring {
+#ifdef CONFIG_APP_SAMPLER_RING
+	struct app_sample buf[CONFIG_APP_SAMPLER_RING_SIZE];
+	uint16_t head;
+	uint16_t count;
+	uint32_t dropped;
+#endif
+	/* Kept after the ring is drained */
+	struct app_sample latest;
+	bool has_latest;
+};
+
+static struct sample_ring rings[ADC_NUM_CHANNELS];
+static struct k_spinlock ring_lock;
+
+static adc_node_t **sampler_nodes;
+static size_t sampler_node_count;
+
+/* Channels attached to one I2C controller */
+struct bus_group {
+	const struct device *bus;
+	uint32_t channels;
+	/* Channels to read for the frame in progress */
+	uint32_t pending;
+#ifdef CONFIG_APP_SAMPLER_RTIO
+	struct rtio *rtio;
+#endif
+	/* Worker thread; not used for the first group, which the sampler thread reads */
+	struct k_sem start;
+	struct k_thread thread;
+};
+
+static struct bus_group groups[CONFIG_APP_SAMPLER_MAX_BUSES];
+static size_t group_count;
+
+K_THREAD_STACK_ARRAY_DEFINE(bus_stacks, MAX(CONFIG_APP_SAMPLER_MAX_BUSES - 1, 1),
+			    CONFIG_APP_SAMPLER_STACK_SIZE);
+
+/* Readings of the frame in progress, filled in by every group */
+static struct app_sample_frame frame;
+static atomic_t frame_valid;
+static K_EVENT_DEFINE(bus_done);
+
+ZBUS_CHAN_DEFINE(sample_chan,
+		 struct app_sample_frame,
+		 NULL,
+		 NULL,
+		 ZBUS_OBSERVERS_EMPTY,
+		 ZBUS_MSG_INIT(0));
+
+/* Channels read on conversion-ready instead of the timer, and those with a pending conversion */
+static uint32_t drdy_channels;
+static K_EVENT_DEFINE(drdy_events);
+
+BUILD_ASSERT(ADC_NUM_CHANNELS <= 32, "Channel sets are 32-bit masks");
+
+K_THREAD_STACK_DEFINE(sampler_stack, CONFIG_APP_SAMPLER_STACK_SIZE);
+static struct k_thread sampler_thread_data;
+static K_TIMER_DEFINE(sample_timer, NULL, NULL);
+
+static void ring_put(struct sample_ring *ring, const struct app_sample *sample)
+{
+	k_spinlock_key_t key = k_spin_lock(&ring_lock);
+
+	ring->latest = *sample;
+	ring->has_latest = true;
+
+#ifdef CONFIG_APP_SAMPLER_RING
+	ring->buf[ring->head] = *sample;
+	ring->head = (ring->head + 1) % CONFIG_APP_SAMPLER_RING_SIZE;
+
+	if (ring->count < CONFIG_APP_SAMPLER_RING_SIZE) {
+		ring->count++;
+	} else {
+		/* Oldest sample was overwritten */
+		ring->dropped++;
+	}
+#endif
+
+	k_spin_unlock(&ring_lock, key);
+}
+
+static void ring_listener_cb(const struct zbus_channel *chan)
+{
+	const struct app_sample_frame *f = zbus_chan_const_msg(chan);
+	struct app_sample sample = { .ts = f->ts };
+
+	for (size_t i = 0; i < sampler_node_count; i++) {
+		if (f->channels & BIT(i)) {
+			sample.raw = f->raw[i];
+			ring_put(&rings[i], &sample);
+		}
+	}
+}
+
+ZBUS_LISTENER_DEFINE(sampler_ring_lis, ring_listener_cb);
+ZBUS_CHAN_ADD_OBS(sample_chan, sampler_ring_lis, 1);
+
+static void frame_put(size_t ch_num, const vcp_raw_t *raw)
+{
+	frame.raw[ch_num] = *raw;
+	atomic_or(&frame_valid, BIT(ch_num));
+}
+
+#ifdef CONFIG_APP_SAMPLER_RTIO
+
+static void read_failed(adc_node_t *adc, int err)
+{
+	if (adc->device_ready) {
+		LOG_ERR("Error reading sensor values from %s: %d", adc->dev->name, err);
+	}
+	adc->device_ready = false;
+}
+
+static int decode_sample(adc_node_t *adc, const uint8_t *buf, struct app_sample *sample)
+{
+	static const enum sensor_channel_ina260 chans[] = {
+		SENSOR_CHAN_INA260_CURRENT_RAW,
+		SENSOR_CHAN_INA260_VOLTAGE_RAW,
+		SENSOR_CHAN_INA260_POWER_RAW,
+	};
+	const struct sensor_decoder_api *decoder;
+	struct sensor_q31_data out;
+	int32_t values[ARRAY_SIZE(chans)];
+	int err;
+
+	err = sensor_get_decoder(adc->dev, &decoder);
+	if (err) {
+		return err;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(chans); i++) {
+		struct sensor_chan_spec spec = { .chan_type = chans[i], .chan_idx = 0 };
+		uint32_t fit = 0;
+
+		if (decoder->decode(buf, spec, &fit, 1, &out) != 1) {
+			return -EBADMSG;
+		}
+
+		/* Raw channels decode with a shift of 31, so the value is the register itself */
+		values[i] = out.readings[0].value;
+	}
+
+	sample->ts = k_ns_to_ticks_floor64(out.header.base_timestamp_ns);
+	sample->raw.current = values[0];
+	sample->raw.voltage = values[1];
+	sample->raw.power = values[2];
+
+	return 0;
+}
+
+/* One context per bus, each sized for a read of every channel in flight at once */
+#define SAMPLER_RTIO_DEFINE(i, _)						\
+	RTIO_DEFINE_WITH_MEMPOOL(sampler_rtio_##i, ADC_NUM_CHANNELS, ADC_NUM_CHANNELS,	\
+				 ADC_NUM_CHANNELS, INA260_ENCODED_DATA_SIZE,	\
+				 sizeof(void *))
+#define SAMPLER_RTIO_PTR(i, _) &sampler_rtio_##i
+
+LISTIFY(CONFIG_APP_SAMPLER_MAX_BUSES, SAMPLER_RTIO_DEFINE, (;));
+
+static struct rtio *const sampler_rtio[] = {
+	LISTIFY(CONFIG_APP_SAMPLER_MAX_BUSES, SAMPLER_RTIO_PTR, (,))
+};
+
+static void read_group(struct bus_group *grp, uint32_t channels)
+{
+	struct app_sample sample;
+	struct rtio_sqe *sqe;
+	struct rtio_cqe *cqe;
+	uint32_t submitted = 0;
+	uint8_t *buf;
+	uint32_t buf_len;
+	int err;
+
+	/* Queue a read of every channel, then submit them as one batch */
+	for (size_t i = 0; i < sampler_node_count; i++) {
+		if (!(channels & BIT(i))) {
+			continue;
+		}
+
+		sqe = rtio_sqe_acquire(grp->rtio);
+		if (sqe == NULL) {
+			break;
+		}
+
+		rtio_sqe_prep_read_with_pool(sqe, sampler_nodes[i]->iodev, RTIO_PRIO_NORM,
+					     (void *)i);
+		submitted++;
+	}
+
+	if (submitted == 0) {
+		return;
+	}
+
+	rtio_submit(grp->rtio, submitted);
+
+	while ((cqe = rtio_cqe_consume(grp->rtio)) != NULL) {
+		size_t ch_num = (size_t)cqe->userdata;
+		adc_node_t *adc = sampler_nodes[ch_num];
+
+		err = cqe->result;
+		if (err == 0) {
+			err = rtio_cqe_get_mempool_buffer(grp->rtio, cqe, &buf, &buf_len);
+		}
+		rtio_cqe_release(grp->rtio, cqe);
+
+		if (err) {
+			read_failed(adc, err);
+			continue;
+		}
+
+		err = decode_sample(adc, buf, &sample);
+		rtio_release_buffer(grp->rtio, buf, buf_len);
+
+		if (err) {
+			read_failed(adc, err);
+			continue;
+		}
+
+		adc->device_ready = true;
+		frame_put(ch_num, &sample.raw);
+	}
+}
+
+#else
+
+static int read_channel(adc_node_t *adc, struct app_sample *sample)
+{
+	struct sensor_value raw;
+	int err;
+
+	err = sensor_sample_fetch(adc->dev);
+	if (err) {
+		if (adc->device_ready) {
+			LOG_ERR("Error fetching sensor values from %s: %d", adc->dev->name, err);
+		}
+		adc->device_ready = false;
+		return err;
+	}
+
+	sample->ts = k_uptime_ticks();
+
+	sensor_channel_get(adc->dev, (enum sensor_channel)SENSOR_CHAN_INA260_VOLTAGE_RAW, &raw);
+	sample->raw.voltage = raw.val1;
+
+	sensor_channel_get(adc->dev, (enum sensor_channel)SENSOR_CHAN_INA260_CURRENT_RAW, &raw);
+	sample->raw.current = raw.val1;
+
+	sensor_channel_get(adc->dev, (enum sensor_channel)SENSOR_CHAN_INA260_POWER_RAW, &raw);
+	sample->raw.power = raw.val1;
+
+	adc->device_ready = true;
+	return 0;
+}
+
+static void read_group(struct bus_group *grp, uint32_t channels)
+{
+	struct app_sample sample;
+
+	for (size_t i = 0; i < sampler_node_count; i++) {
+		if ((channels & BIT(i)) && (read_channel(sampler_nodes[i], &sample) == 0)) {
+			frame_put(i, &sample.raw);
+		}
+	}
+}
+
+#endif /* CONFIG_APP_SAMPLER_RTIO */
+
+static void bus_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct bus_group *grp = arg1;
+
+	while (true) {
+		k_sem_take(&grp->start, K_FOREVER);
+		read_group(grp, grp->pending);
+		k_event_post(&bus_done, BIT(grp - groups));
+	}
+}
+
+/*
+ * Read one frame: every bus is read at the same time and all readings share
+ * the timestamp of the start of the frame
+ */
+static void sample_channels(uint32_t channels)
+{
+	int64_t ts = k_uptime_ticks();
+	uint32_t started = 0;
+	int err;
+
+	atomic_clear(&frame_valid);
+	k_event_clear(&bus_done, BIT_MASK(group_count));
+
+	/* Start the other buses first so they transfer while this thread reads the first */
+	for (size_t i = 1; i < group_count; i++) {
+		groups[i].pending = channels & groups[i].channels;
+		if (groups[i].pending) {
+			k_sem_give(&groups[i].start);
+			started |= BIT(i);
+		}
+	}
+
+	read_group(&groups[0], channels & groups[0].channels);
+
+	if (started) {
+		k_event_wait_all(&bus_done, started, false, K_FOREVER);
+	}
+
+	frame.ts = ts;
+	frame.channels = atomic_get(&frame_valid);
+	frame.missed = channels & ~frame.channels;
+	if ((frame.channels | frame.missed) == 0) {
+		return;
+	}
+
+	/* Only waits if a consumer is reading the channel right now */
+	err = zbus_chan_pub(&sample_chan, &frame, K_USEC(SAMPLE_PERIOD_US / 2));
+	if (err) {
+		LOG_WRN("Unable to publish sample frame: %d", err);
+	}
+}
+
+#ifdef CONFIG_APP_SAMPLER_DATA_READY
+static void drdy_handler(const struct device *dev, const struct sensor_trigger *trig)
+{
+	for (size_t i = 0; i < sampler_node_count; i++) {
+		if (sampler_nodes[i]->dev == dev) {
+			k_event_post(&drdy_events, BIT(i));
+			return;
+		}
+	}
+}
+
+static void enable_data_ready(void)
+{
+	static const struct sensor_trigger trig = {
+		.type = SENSOR_TRIG_DATA_READY,
+		.chan = SENSOR_CHAN_ALL,
+	};
+
+	for (size_t i = 0; i < sampler_node_count; i++) {
+		if (sensor_trigger_set(sampler_nodes[i]->dev, &trig, drdy_handler) == 0) {
+			drdy_channels |= BIT(i);
+		} else {
+			LOG_WRN("%s has no conversion-ready trigger; using timer",
+				sampler_nodes[i]->dev->name);
+		}
+	}
+}
+#endif /* CONFIG_APP_SAMPLER_DATA_READY */
+
+static void sampler_thread(void *arg1, void *arg2, void *arg3)
+{
+	uint32_t timer_channels = BIT_MASK(sampler_node_count) & ~drdy_channels;
+
+	if (timer_channels == 0) {
+		while (true) {
+			/* Wait for a conversion; clearing returns every channel that completed */
+			k_event_wait(&drdy_events, drdy_channels, false, K_FOREVER);
+			sample_channels(k_event_clear(&drdy_events, drdy_channels));
+		}
+	}
+
+	/* The timer keeps the sample period independent of I2C latency */
+	k_timer_start(&sample_timer, K_USEC(SAMPLE_PERIOD_US), K_USEC(SAMPLE_PERIOD_US));
+
+	while (true) {
+		k_timer_status_sync(&sample_timer);
+
+		sample_channels(timer_channels | k_event_clear(&drdy_events, drdy_channels));
+	}
+}
+
+#ifdef CONFIG_APP_SAMPLER_RING
+size_t app_sampler_drain(uint8_t ch_num, struct app_sample *out, size_t max)
+{
+	struct sample_ring *ring;
+	uint32_t dropped;
+	size_t copied = 0;
+
+	if (ch_num >= sampler_node_count) {
+		return 0;
+	}
+
+	ring = &rings[ch_num];
+
+	k_spinlock_key_t key = k_spin_lock(&ring_lock);
+
+	while ((copied < max) && (ring->count > 0)) {
+		uint16_t tail = (ring->head + CONFIG_APP_SAMPLER_RING_SIZE - ring->count) %
+				CONFIG_APP_SAMPLER_RING_SIZE;
+
+		out[copied++] = ring->buf[tail];
+		ring->count--;
+	}
+
+	dropped = ring->dropped;
+	ring->dropped = 0;
+
+	k_spin_unlock(&ring_lock, key);
+
+	if (dropped) {
+		LOG_WRN("ch%d: %u samples overwritten before they were reported", ch_num, dropped);
+	}
+
+	return copied;
+}
+#endif /* CONFIG_APP_SAMPLER_RING */
+
+int app_sampler_latest(uint8_t ch_num, struct app_sample *out)
+{
+	int err = -ENODATA;
+
+	if (ch_num >= sampler_node_count) {
+		return -EINVAL;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&ring_lock);
+
+	if (rings[ch_num].has_latest) {
+		*out = rings[ch_num].latest;
+		err = 0;
+	}
+
+	k_spin_unlock(&ring_lock, key);
+
+	return err;
+}
+
+/* Group channels by the I2C controller they are attached to */
+static void group_channels(void)
+{
+	for (size_t i = 0; i < sampler_node_count; i++) {
+		const struct device *bus = sampler_nodes[i]->bus;
+		size_t g;
+
+		for (g = 0; g < group_count; g++) {
+			if (groups[g].bus == bus) {
+				break;
+			}
+		}
+
+		if (g == ARRAY_SIZE(groups)) {
+			g = ARRAY_SIZE(groups) - 1;
+			LOG_WRN("%s shares a thread with %s; raise APP_SAMPLER_MAX_BUSES",
+				bus->name, groups[g].bus->name);
+		} else if (g == group_count) {
+			groups[g].bus = bus;
+			group_count++;
+		}
+
+		groups[g].channels |= BIT(i);
+	}
+}
+
+static void start_bus_threads(void)
+{
+	for (size_t g = 0; g < group_count; g++) {
+		IF_ENABLED(CONFIG_APP_SAMPLER_RTIO, (groups[g].rtio = sampler_rtio[g];));
+
+		LOG_DBG("%s: channels 0x%x", groups[g].bus->name, groups[g].channels);
+
+		if (g == 0) {
+			continue;
+		}
+
+		k_sem_init(&groups[g].start, 0, 1);
+		k_thread_create(&groups[g].thread, bus_stacks[g - 1],
+				K_THREAD_STACK_SIZEOF(bus_stacks[g - 1]),
+				bus_thread, &groups[g], NULL, NULL,
+				CONFIG_APP_SAMPLER_THREAD_PRIORITY, 0, K_NO_WAIT);
+		k_thread_name_set(&groups[g].thread, groups[g].bus->name);
+	}
+}
+
+int app_sampler_start(adc_node_t **nodes, size_t count)
+{
+	if (count > ARRAY_SIZE(rings)) {
+		LOG_ERR("Sampler supports at most %d channels", ARRAY_SIZE(rings));
+		return -EINVAL;
+	}
+
+	sampler_nodes = nodes;
+	sampler_node_count = count;
+
+	group_channels();
+	start_bus_threads();
+
+	IF_ENABLED(CONFIG_APP_SAMPLER_DATA_READY, (enable_data_ready();));
+
+	k_thread_create(&sampler_thread_data, sampler_stack,
+			K_THREAD_STACK_SIZEOF(sampler_stack),
+			sampler_thread, NULL, NULL, NULL,
+			CONFIG_APP_SAMPLER_THREAD_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&sampler_thread_data, "sampler");
+
+	LOG_INF("Sampling %d channels on %d buses at %d Hz", count, group_count,
+		CONFIG_APP_SAMPLER_RATE_HZ);
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Read every INA260 channel at a fixed rate on a dedicated thread.
+ *
+ * Each set of readings is published as one frame on the `sample_chan` zbus
+ * channel. Consumers add themselves as observers of the channel in their own
+ * module; only quick work belongs in a listener, since listeners run on the
+ * sampler thread.
+ *
+ * The sampler's own listener keeps the latest reading of each channel. With
+ * CONFIG_APP_SAMPLER_RING it also stores readings in a fixed-size ring buffer
+ * per channel, which a consumer drains on its own schedule.
+ */
+
+#ifndef __APP_SAMPLER_H__
+#define __APP_SAMPLER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/zbus/zbus.h>
+#include "app_sensors.h"
+
+/** A single raw INA260 reading */
+struct app_sample {
+	/** Uptime in ticks when the reading was taken */
+	int64_t ts;
+	vcp_raw_t raw;
+};
+
+/** Readings of every channel taken in one sampling period */
+struct app_sample_frame {
+	/** Uptime in ticks when the frame was read, shared by every reading */
+	int64_t ts;
+	/** Bit per channel read in this frame; the other entries of @p raw are stale */
+	uint32_t channels;
+	/** Bit per channel that was due in this frame but could not be read */
+	uint32_t missed;
+	vcp_raw_t raw[ADC_NUM_CHANNELS];
+};
+
+/** Carries a struct app_sample_frame for every sampling period */
+ZBUS_CHAN_DECLARE(sample_chan);
+
+/**
+ * @brief Start the sampler thread
+ *
+ * @param nodes Array of channels to sample, indexed by channel number
+ * @param count Number of entries in @p nodes
+ *
+ * @return 0 on success, or a negative error code
+ */
+int app_sampler_start(adc_node_t **nodes, size_t count);
+
+/**
+ * @brief Remove the oldest buffered samples for a channel
+ *
+ * Only available with CONFIG_APP_SAMPLER_RING.
+ *
+ * @param ch_num Channel number
+ * @param out Buffer to copy samples into, oldest first
+ * @param max Number of samples that fit in @p out
+ *
+ * @return Number of samples copied into @p out
+ */
+size_t app_sampler_drain(uint8_t ch_num, struct app_sample *out, size_t max);
+
+/**
+ * @brief Get the most recent sample of a channel without removing anything
+ *
+ * @return 0 on success, or -ENODATA if the channel has not been read yet
+ */
+int app_sampler_latest(uint8_t ch_num, struct app_sample *out);
+
+#endif /* __APP_SAMPLER_H__ */
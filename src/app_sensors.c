@@ -9,21 +9,28 @@ LOG_MODULE_REGISTER(app_sensors, LOG_LEVEL_DBG);
 
 #include <stdlib.h>
 #include <golioth/client.h>
-#include <golioth/lightdb_state.h>
 #include <golioth/stream.h>
-#include <zcbor_decode.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/i2c.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/drivers/spi.h>
-
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/barrier.h>
+
+#include "app_alert.h"
+#include "app_batch.h"
+#include "app_checkpoint.h"
+#include "app_encode.h"
+#include "app_sampler.h"
 #include "app_sensors.h"
 #include "app_state.h"
 #include "app_settings.h"
+#include "app_store.h"
+#include "app_ts_block.h"
 
-/* FIXME: this is an awkward include */
-#include "../drivers/sensor/ina260/ina260.h"
+#include <drivers/sensor/ina260.h>
 
 /* Convert DC reading to actual value */
 int64_t calculate_reading(uint8_t upper, uint8_t lower)
@@ -45,276 +52,530 @@ static const struct device *o_dev = DEVICE_DT_GET_ANY(golioth_ostentus);
 
 static struct golioth_client *client;
 
-struct k_sem adc_data_sem;
+/*
+ * Sequence lock over the counters of every channel. Writers serialize on the
+ * spinlock and keep the sequence odd while updating; readers never block and
+ * retry if the sequence was odd or changed while they copied.
+ */
+static struct k_spinlock counters_lock;
+static atomic_t counters_seq;
 
-/* Formatting string for sending sensor JSON to Golioth */
-#define JSON_FMT "{\"cur\":{\"ch0\":%d,\"ch1\":%d},\"vol\":{\"ch0\":%d,\"ch1\":%d},\"pow\":{\"ch0\":%d,\"ch1\":%d}}"
-#define JSON_FMT_SINGLE "{\"cur\":{\"%s\":%d},\"vol\":{\"%s\":%d},\"pow\":{\"%s\":%d}}"
-#define CH0_PATH "ch0"
-#define CH1_PATH "ch1"
 #define ADC_STREAM_ENDP	"sensor"
-#define ADC_CUMULATIVE_ENDP	"state/cumulative"
-
-#define ADC_CH0 0
-#define ADC_CH1 1
-
-adc_node_t adc_ch0 = {
-	.dev = DEVICE_DT_GET(DT_NODELABEL(ina260_ch0)),
-	.ch_num = ADC_CH0,
-	.laston = -1,
-	.runtime = 0,
-	.total_unreported = 0,
-	.total_cloud = 0,
-	.loaded_from_cloud = false,
-	.device_ready = false
+
+/* Per-node objects are named after the node's dependency ordinal */
+#define ADC_IODEV_NAME(node_id) UTIL_CAT(ina260_iodev_, DT_DEP_ORD(node_id))
+
+#ifdef CONFIG_APP_SAMPLER_RTIO
+#define INA260_RAW_READ_IODEV(node_id)						\
+	SENSOR_DT_READ_IODEV(ADC_IODEV_NAME(node_id), node_id,			\
+			     {SENSOR_CHAN_INA260_CURRENT_RAW, 0},		\
+			     {SENSOR_CHAN_INA260_VOLTAGE_RAW, 0},		\
+			     {SENSOR_CHAN_INA260_POWER_RAW, 0});
+
+DT_FOREACH_STATUS_OKAY(ti_ina260, INA260_RAW_READ_IODEV)
+#endif
+
+#define ADC_NODE_INIT(node_id)							\
+	[DT_PROP(node_id, channel)] = {						\
+		.dev = DEVICE_DT_GET(node_id),					\
+		.bus = DEVICE_DT_GET(DT_BUS(node_id)),				\
+		.laston = -1,							\
+		.last_ts = -1,							\
+		.device_ready = false,						\
+		IF_ENABLED(CONFIG_APP_SAMPLER_RTIO,				\
+			   (.iodev = &ADC_IODEV_NAME(node_id),))		\
+	},
+
+#define ADC_CHANNEL_CHECK(node_id)						\
+	BUILD_ASSERT(DT_PROP(node_id, channel) < ADC_NUM_CHANNELS,		\
+		     "ti,ina260 channel property must be below the number of channels");
+
+DT_FOREACH_STATUS_OKAY(ti_ina260, ADC_CHANNEL_CHECK)
+
+#define ADC_CHANNEL_BIT(node_id) BIT(DT_PROP(node_id, channel)) |
+
+/* A duplicate number leaves a bit clear, and would silently replace a channel below */
+BUILD_ASSERT((DT_FOREACH_STATUS_OKAY(ti_ina260, ADC_CHANNEL_BIT) 0) ==
+	     BIT_MASK(ADC_NUM_CHANNELS),
+	     "ti,ina260 channel properties must be unique");
+
+/* Indexed by the channel property, so numbers do not depend on devicetree order */
+static adc_node_t adc_channels[ADC_NUM_CHANNELS] = {
+	DT_FOREACH_STATUS_OKAY(ti_ina260, ADC_NODE_INIT)
 };
 
-adc_node_t adc_ch1 = {
-	.dev = DEVICE_DT_GET(DT_NODELABEL(ina260_ch1)),
-	.ch_num = ADC_CH1,
-	.laston = -1,
-	.runtime = 0,
-	.total_unreported = 0,
-	.total_cloud = 0,
-	.loaded_from_cloud = false,
-	.device_ready = false
+#define ADC_NODE_PTR(i, _) &adc_channels[i]
+
+static adc_node_t *adc_nodes[ADC_NUM_CHANNELS] = {
+	LISTIFY(ADC_NUM_CHANNELS, ADC_NODE_PTR, (,))
 };
 
-void get_ontime(struct ontime *ot)
+#ifdef CONFIG_APP_STREAM_TS_BLOCK
+/* Scratch space used by the reporting path to drain the sampler */
+static struct app_sample drain_buf[32];
+#endif
+
+/* Statistics for the current report window, indexed by channel number */
+static struct vcp_window windows[ADC_NUM_CHANNELS];
+static struct k_spinlock window_lock;
+/* Copy of the windows taken by the reporting path, summarized outside the lock */
+static struct vcp_window window_snap[ADC_NUM_CHANNELS];
+static struct vcp_report reports[ADC_NUM_CHANNELS];
+
+/* Last reports sent to Golioth, used to decide whether a new report is needed */
+static struct vcp_report last_reports[ADC_NUM_CHANNELS];
+static int64_t last_report_time = -1;
+
+static uint8_t cbor_buf[APP_ENCODE_REPORT_MAX_SIZE];
+
+/* State write carrying total_inflight, or 0 if none; protected by counters_lock */
+static uint32_t inflight_seq;
+static uint32_t report_seq;
+static int64_t inflight_since;
+
+static k_spinlock_key_t counters_write_begin(void)
 {
-	ot->ch0 = adc_ch0.runtime;
-	ot->ch1 = adc_ch1.runtime;
+	k_spinlock_key_t key = k_spin_lock(&counters_lock);
+
+	atomic_inc(&counters_seq);
+	return key;
 }
 
-/* Callback for LightDB Stream */
-static void async_error_handler(struct golioth_client *client,
-				const struct golioth_response *response,
-				const char *path,
-				void *arg)
+static void counters_write_end(k_spinlock_key_t key)
 {
-	if (response->status != GOLIOTH_OK) {
-		LOG_ERR("Async task failed: %d", response->status);
-		return;
-	}
+	atomic_inc(&counters_seq);
+	k_spin_unlock(&counters_lock, key);
 }
 
-static int get_adc_reading(adc_node_t *adc)
+void app_sensors_get_counters(struct adc_counters *out)
 {
-	int err;
+	atomic_val_t seq;
 
-	err = sensor_sample_fetch(adc->dev);
-	if (err) {
-		LOG_ERR("Error fetching sensor values from %s: %d", adc->dev->name, err);
-		adc->device_ready = false;
-		return err;
-	}
+	do {
+		seq = atomic_get(&counters_seq);
 
-	adc->device_ready = true;
-	return 0;
+		for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+			out[i] = adc_nodes[i]->counters;
+		}
+
+		barrier_dmem_fence_full();
+	} while ((seq & 1) || (atomic_get(&counters_seq) != seq));
 }
 
-static int log_sensor_values(adc_node_t *sensor, bool get_new_reading)
+/* Power LSB is 10 mW and the accumulator holds twice the area: 10 / 2 / 3600 = 1 / 720 */
+int64_t adc_energy_mwh(const struct adc_counters *counters)
 {
-	int err;
+	return counters->energy_acc / ((uint64_t)CONFIG_SYS_CLOCK_TICKS_PER_SEC * 720);
+}
 
-	if (get_new_reading) {
-		err = get_adc_reading(sensor);
-		if (err) {
-			return err;
+/* Current LSB is 1.25 mA and the accumulator holds twice the area: 1.25 / 2 / 3600 = 1 / 5760 */
+int64_t adc_charge_mah(const struct adc_counters *counters)
+{
+	return counters->charge_acc / ((int64_t)CONFIG_SYS_CLOCK_TICKS_PER_SEC * 5760);
+}
+
+static void stat_reset(struct vcp_stat *stat)
+{
+	stat->min = INT32_MAX;
+	stat->max = INT32_MIN;
+	stat->sum = 0;
+	stat->sum_sq = 0;
+}
+
+static void stat_add(struct vcp_stat *stat, int32_t value)
+{
+	stat->min = MIN(stat->min, value);
+	stat->max = MAX(stat->max, value);
+	stat->sum += value;
+	stat->sum_sq += (uint64_t)((int64_t)value * value);
+}
+
+static int32_t stat_mean(const struct vcp_stat *stat, uint32_t count)
+{
+	return (int32_t)(stat->sum / (int64_t)count);
+}
+
+/* Integer square root, rounded down */
+static uint32_t isqrt64(uint64_t value)
+{
+	uint64_t res = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > value) {
+		bit >>= 2;
+	}
+
+	while (bit != 0) {
+		if (value >= res + bit) {
+			value -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
 		}
+		bit >>= 2;
 	}
 
-	if (sensor->device_ready) {
-		struct sensor_value cur, pow, vol;
+	return (uint32_t)res;
+}
 
-		sensor_channel_get(sensor->dev,
-				   (enum sensor_channel)SENSOR_CHAN_VOLTAGE,
-				   &vol);
-		sensor_channel_get(sensor->dev,
-				   (enum sensor_channel)SENSOR_CHAN_CURRENT,
-					   &cur);
-		sensor_channel_get(sensor->dev,
-				   (enum sensor_channel)SENSOR_CHAN_POWER,
-				   &pow);
+static uint32_t stat_rms(const struct vcp_stat *stat, uint32_t count)
+{
+	return isqrt64(stat->sum_sq / count);
+}
 
-		LOG_INF("Device: %s, %f V, %f A, %f W",
-			sensor->dev->name,
-			sensor_value_to_double(&vol),
-			sensor_value_to_double(&cur),
-			sensor_value_to_double(&pow)
-			);
+static void window_reset(struct vcp_window *window)
+{
+	window->count = 0;
+	stat_reset(&window->cur);
+	stat_reset(&window->vol);
+	stat_reset(&window->pow);
+}
 
-		IF_ENABLED(CONFIG_LIB_OSTENTUS, (
-			char ostentus_buf[32];
-			uint8_t slide_num;
-
-			snprintk(ostentus_buf, sizeof(ostentus_buf), "%.02f V",
-				 sensor_value_to_double(&vol));
-			slide_num = (sensor->ch_num == 0) ? CH0_VOLTAGE : CH1_VOLTAGE;
-			ostentus_slide_set(o_dev, slide_num, ostentus_buf, strlen(ostentus_buf));
-
-			snprintk(ostentus_buf, sizeof(ostentus_buf), "%.02f mA",
-				 sensor_value_to_double(&cur) * 1000);
-			slide_num = (sensor->ch_num == 0) ? CH0_CURRENT : CH1_CURRENT;
-			ostentus_slide_set(o_dev, slide_num, ostentus_buf, strlen(ostentus_buf));
-
-			snprintk(ostentus_buf, sizeof(ostentus_buf), "%.02f W",
-				 sensor_value_to_double(&pow));
-			slide_num = (sensor->ch_num == 0) ? CH0_POWER : CH1_POWER;
-			ostentus_slide_set(o_dev, slide_num, ostentus_buf, strlen(ostentus_buf));
-		));
-	} else {
-		return -ENODATA;
+static void window_add(struct vcp_window *window, const struct app_sample *samples, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		stat_add(&window->cur, samples[i].raw.current);
+		stat_add(&window->vol, samples[i].raw.voltage);
+		stat_add(&window->pow, samples[i].raw.power);
 	}
+	window->count += count;
+}
 
-	return 0;
+static void stat_summarize(const struct vcp_stat *stat, uint32_t count,
+			   struct vcp_summary *summary)
+{
+	summary->min = stat->min;
+	summary->max = stat->max;
+	summary->mean = stat_mean(stat, count);
+	summary->rms = stat_rms(stat, count);
 }
 
-static int get_raw_sensor_values(adc_node_t *sensor, vcp_raw_t *values, bool get_new_reading)
+static void window_summarize(const struct vcp_window *window, struct vcp_report *report)
 {
-	int err;
+	memset(report, 0, sizeof(*report));
 
-	if (get_new_reading) {
-		err = get_adc_reading(sensor);
-		if (err) {
-			return err;
-		}
+	if (window->count == 0) {
+		return;
 	}
 
-	if (sensor->device_ready) {
-		struct sensor_value raw;
+	report->count = window->count;
+	stat_summarize(&window->cur, window->count, &report->cur);
+	stat_summarize(&window->vol, window->count, &report->vol);
+	stat_summarize(&window->pow, window->count, &report->pow);
+}
 
-		sensor_channel_get(sensor->dev,
-				   (enum sensor_channel)SENSOR_CHAN_INA260_VOLTAGE_RAW,
-				   &raw);
-		values->voltage = raw.val1;
+static const struct vcp_summary *report_quantity(const struct vcp_report *report,
+						 enum vcp_quantity quantity)
+{
+	switch (quantity) {
+	case VCP_CURRENT:
+		return &report->cur;
+	case VCP_VOLTAGE:
+		return &report->vol;
+	default:
+		return &report->pow;
+	}
+}
 
-		sensor_channel_get(sensor->dev,
-				   (enum sensor_channel)SENSOR_CHAN_INA260_CURRENT_RAW,
-				   &raw);
-		values->current = raw.val1;
+/*
+ * Check whether the new reports need to be streamed. A report is needed when any
+ * reading left the deadband around the last streamed mean, when a channel
+ * appeared or disappeared, or when the heartbeat interval has expired.
+ */
+static bool reports_changed(void)
+{
+	int32_t heartbeat_s = get_report_heartbeat_s();
 
-		sensor_channel_get(sensor->dev,
-				   (enum sensor_channel)SENSOR_CHAN_INA260_POWER_RAW,
-				   &raw);
-		values->power = raw.val1;
+	if (heartbeat_s == 0) {
+		/* Report-on-change is disabled */
+		return true;
+	}
 
-	} else {
-		return -ENODATA;
+	if ((last_report_time < 0) ||
+	    (k_uptime_get() - last_report_time >= (int64_t)heartbeat_s * MSEC_PER_SEC)) {
+		return true;
 	}
 
-	return 0;
+	for (size_t i = 0; i < ARRAY_SIZE(reports); i++) {
+		if ((reports[i].count == 0) != (last_reports[i].count == 0)) {
+			return true;
+		}
+
+		if (reports[i].count == 0) {
+			continue;
+		}
+
+		for (int q = 0; q < VCP_NUM_QUANTITIES; q++) {
+			const struct vcp_summary *now = report_quantity(&reports[i], q);
+			int32_t ref = report_quantity(&last_reports[i], q)->mean;
+			int32_t deadband = get_deadband(i, q);
+
+			if ((now->max > ref + deadband) || (now->min < ref - deadband)) {
+				return true;
+			}
+		}
+	}
+
+	return false;
 }
 
-static int push_dual_adc_to_golioth(vcp_raw_t *ch0_raw, vcp_raw_t *ch1_raw)
+static int push_reports_to_golioth(void)
 {
+	int age_offset;
 	int err;
-	char json_buf[128];
-
-	snprintk(json_buf,
-		 sizeof(json_buf),
-		 JSON_FMT,
-		 ch0_raw->current,
-		 ch1_raw->current,
-		 ch0_raw->voltage,
-		 ch1_raw->voltage,
-		 ch0_raw->power,
-		 ch1_raw->power
-		 );
-
-	err = golioth_stream_set_async(client,
-				       ADC_STREAM_ENDP,
-				       GOLIOTH_CONTENT_TYPE_JSON,
-				       json_buf,
-				       strlen(json_buf),
-				       async_error_handler,
-				       NULL);
+	int len;
+
+	len = app_encode_report(cbor_buf, sizeof(cbor_buf), reports, ARRAY_SIZE(reports),
+				&age_offset);
+	if (len < 0) {
+		return len;
+	}
+
+	err = app_store_stream(ADC_STREAM_ENDP,
+			       GOLIOTH_CONTENT_TYPE_CBOR,
+			       cbor_buf,
+			       len,
+			       k_uptime_get(),
+			       age_offset);
 	if (err) {
 		LOG_ERR("Failed to send sensor data to Golioth: %d", err);
 		return err;
 	}
 
-	app_state_report_ontime(&adc_ch0, &adc_ch1);
-
 	return 0;
 }
 
-static int push_single_adc_to_golioth(vcp_raw_t *single_ch_data, char *single_ch_path)
+/*
+ * Integrate energy and charge over each sample interval using the trapezoidal
+ * rule; caller must hold the counters write lock
+ */
+static void integrate_energy(adc_node_t *ch, const struct app_sample *sample)
 {
-	int err;
-	char json_buf[128];
-
-	snprintk(json_buf,
-		 sizeof(json_buf),
-		 JSON_FMT_SINGLE,
-		 single_ch_path,
-		 single_ch_data->current,
-		 single_ch_path,
-		 single_ch_data->voltage,
-		 single_ch_path,
-		 single_ch_data->power
-		 );
-
-	err = golioth_stream_set_async(client,
-				       ADC_STREAM_ENDP,
-				       GOLIOTH_CONTENT_TYPE_JSON,
-				       json_buf,
-				       strlen(json_buf),
-				       async_error_handler,
-				       NULL);
-	if (err) {
-		LOG_ERR("Failed to send sensor data to Golioth: %d", err);
-		return err;
+	if (ch->last_ts >= 0) {
+		int64_t dt = sample->ts - ch->last_ts;
+
+		ch->counters.energy_acc += ((uint64_t)ch->last_raw.power + sample->raw.power) * dt;
+		ch->counters.charge_acc += ((int64_t)ch->last_raw.current + sample->raw.current) * dt;
 	}
 
-	app_state_report_ontime(&adc_ch0, &adc_ch1);
+	ch->last_ts = sample->ts;
+	ch->last_raw = sample->raw;
+}
 
-	return 0;
+static void update_ontime(adc_node_t *ch, const struct app_sample *sample)
+{
+	integrate_energy(ch, sample);
+
+	if (sample->raw.current <= get_adc_floor(ch->ch_num)) {
+		ch->counters.runtime = 0;
+		ch->laston = -1;
+	} else {
+		int64_t ts = k_ticks_to_ms_floor64(sample->ts);
+		int64_t duration;
+
+		if (ch->laston > 0) {
+			duration = ts - ch->laston;
+		} else {
+			duration = 1;
+		}
+		ch->counters.runtime += duration;
+		ch->laston = ts;
+		ch->counters.total_unreported += duration;
+	}
 }
 
-static int update_ontime(int16_t adc_value, adc_node_t *ch)
+/* Update the counters of every channel in a frame as one write */
+static void account_frame(const struct app_sample_frame *frame)
 {
-	if (k_sem_take(&adc_data_sem, K_MSEC(300)) == 0) {
-		if (adc_value <= get_adc_floor(ch->ch_num)) {
-			ch->runtime = 0;
-			ch->laston = -1;
+	struct app_sample sample = { .ts = frame->ts };
+	k_spinlock_key_t key = counters_write_begin();
+
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		if (frame->channels & BIT(i)) {
+			sample.raw = frame->raw[i];
+			update_ontime(adc_nodes[i], &sample);
+		} else if (frame->missed & BIT(i)) {
+			/* Do not integrate or count on-time across a failed read */
+			adc_nodes[i]->last_ts = -1;
+			adc_nodes[i]->laston = -1;
 		}
-		else {
-			int64_t ts = k_uptime_get();
-			int64_t duration;
-			if (ch->laston > 0) {
-				duration = ts - ch->laston;
-			} else {
-				duration = 1;
-			}
-			ch->runtime += duration;
-			ch->laston = ts;
-			ch->total_unreported += duration;
+	}
+
+	counters_write_end(key);
+
+	/* Every sample reaches the report statistics, however long the report period */
+	key = k_spin_lock(&window_lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(windows); i++) {
+		if (frame->channels & BIT(i)) {
+			sample.raw = frame->raw[i];
+			window_add(&windows[i], &sample, 1);
 		}
-		k_sem_give(&adc_data_sem);
-		return 0;
 	}
-	else {
-		return -EACCES;
+
+	k_spin_unlock(&window_lock, key);
+}
+
+/* On-time and energy accounting gets a copy of every frame on its own thread */
+ZBUS_MSG_SUBSCRIBER_DEFINE(accounting_sub);
+ZBUS_CHAN_ADD_OBS(sample_chan, accounting_sub, 3);
+
+BUILD_ASSERT(IS_ENABLED(CONFIG_ZBUS_MSG_SUBSCRIBER_BUF_ALLOC_DYNAMIC) ||
+	     (sizeof(struct app_sample_frame) <=
+	      CONFIG_ZBUS_MSG_SUBSCRIBER_NET_BUF_STATIC_DATA_SIZE),
+	     "Raise CONFIG_ZBUS_MSG_SUBSCRIBER_NET_BUF_STATIC_DATA_SIZE for the number of channels");
+
+static void accounting_thread(void *arg1, void *arg2, void *arg3)
+{
+	const struct zbus_channel *chan;
+	struct app_sample_frame frame;
+
+	while (zbus_sub_wait_msg(&accounting_sub, &chan, &frame, K_FOREVER) == 0) {
+		account_frame(&frame);
 	}
 }
 
-int reset_cumulative_totals(void)
+K_THREAD_DEFINE(accounting_tid, CONFIG_APP_ACCOUNTING_STACK_SIZE, accounting_thread,
+		NULL, NULL, NULL, CONFIG_APP_ACCOUNTING_THREAD_PRIORITY, 0, 0);
+
+/* Return the on-time in flight to the unreported totals; caller must hold counters_lock */
+static void requeue_inflight(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		struct adc_counters *counters = &adc_nodes[i]->counters;
+
+		counters->total_unreported += counters->total_inflight;
+		counters->total_inflight = 0;
+	}
+
+	inflight_seq = 0;
+}
+
+void app_sensors_report_done(uint32_t seq, bool acked)
 {
-	if (k_sem_take(&adc_data_sem, K_MSEC(5000)) == 0) {
-		k_sem_give(&adc_data_sem);
-		adc_ch0.total_cloud = 0;
-		adc_ch1.total_cloud = 0;
-		adc_ch0.total_unreported = 0;
-		adc_ch1.total_unreported = 0;
-		k_sem_give(&adc_data_sem);
+	k_spinlock_key_t key = counters_write_begin();
+
+	if (seq != inflight_seq) {
+		/* Late result of a write that already timed out or was superseded */
+		counters_write_end(key);
+		LOG_DBG("Ignoring result of state write %u", seq);
+		return;
+	}
+
+	if (acked) {
+		for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+			struct adc_counters *counters = &adc_nodes[i]->counters;
+
+			counters->total_cloud += counters->total_inflight;
+			counters->total_inflight = 0;
+		}
+
+		inflight_seq = 0;
 	} else {
-		LOG_ERR("Could not reset cumulative values; blocked by semaphore.");
-		return -EACCES;
+		requeue_inflight();
+	}
+
+	counters_write_end(key);
+}
+
+/* Send the counters; what was unreported is held in flight until the write is acknowledged */
+static int report_counters(void)
+{
+	struct adc_counters snapshot[ADC_NUM_CHANNELS];
+	bool timed_out = false;
+	uint32_t seq;
+	int err;
+
+	k_spinlock_key_t key = counters_write_begin();
+
+	if (inflight_seq != 0) {
+		if (k_uptime_get() - inflight_since <
+		    CONFIG_APP_STATE_ACK_TIMEOUT_S * MSEC_PER_SEC) {
+			counters_write_end(key);
+			return -EBUSY;
+		}
+
+		/* Resend what was in flight along with anything new */
+		requeue_inflight();
+		timed_out = true;
+	}
+
+	seq = ++report_seq;
+	if (seq == 0) {
+		seq = ++report_seq;
 	}
 
-	/* Send new values to Golioth */
-	int err = app_state_report_ontime(&adc_ch0, &adc_ch1);
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		struct adc_counters *counters = &adc_nodes[i]->counters;
+
+		/* The written total is absolute, so it holds the pending delta either way */
+		if (counters->loaded_from_cloud) {
+			counters->total_inflight = counters->total_unreported;
+			counters->total_unreported = 0;
+		}
+
+		snapshot[i] = *counters;
+	}
+
+	inflight_seq = seq;
+	inflight_since = k_uptime_get();
+
+	counters_write_end(key);
+
+	if (timed_out) {
+		LOG_WRN("State write not acknowledged; resending on-time");
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(snapshot); i++) {
+		LOG_DBG("Ontime (ch%d): %lld", (int)i, snapshot[i].runtime);
+	}
+
+	err = app_state_report_ontime(snapshot, ARRAY_SIZE(snapshot), seq);
+	if (err) {
+		app_sensors_report_done(seq, false);
+	}
+
+	if ((err == -EAGAIN) || (err == -ENOTCONN)) {
+		key = counters_write_begin();
+
+		/*
+		 * No request was made with this number, so the next write may
+		 * reuse it. After any other error a request may have gone out,
+		 * and a late answer to it must not match a later write.
+		 */
+		if (report_seq == seq) {
+			report_seq--;
+		}
+
+		counters_write_end(key);
+	}
+
+	return err;
+}
+
+int reset_cumulative_totals(void)
+{
+	k_spinlock_key_t key = counters_write_begin();
+
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		adc_nodes[i]->counters.total_cloud = 0;
+		adc_nodes[i]->counters.total_unreported = 0;
+		adc_nodes[i]->counters.total_inflight = 0;
+		adc_nodes[i]->counters.energy_acc = 0;
+		adc_nodes[i]->counters.charge_acc = 0;
+	}
+
+	/* The write in flight holds the old totals; its result no longer matters */
+	inflight_seq = 0;
+
+	counters_write_end(key);
+
+	app_checkpoint_request();
+
+	/* Send new values to Golioth, even if they were already close to zero */
+	app_state_update_actual();
+
+	int err = report_counters();
 
 	if (err) {
 		LOG_ERR("Unable to send ontime to server: %d", err);
@@ -323,13 +584,29 @@ int reset_cumulative_totals(void)
 	return err;
 }
 
+#ifdef CONFIG_APP_STREAM_TS_BLOCK
+/* Drain buffered samples for one channel into its time-series block */
+static void drain_channel(adc_node_t *adc)
+{
+	size_t total = 0;
+	size_t count;
+
+	while ((count = app_sampler_drain(adc->ch_num, drain_buf, ARRAY_SIZE(drain_buf))) > 0) {
+		app_ts_block_add(adc->ch_num, drain_buf, count);
+		total += count;
+	}
+
+	if (total > 0) {
+		LOG_DBG("Drained %zu samples from %s", total, adc->dev->name);
+	}
+}
+#endif
+
 /* This will be called by the main() loop */
 /* Do all of your work here! */
 void app_sensors_read_and_stream(void)
 {
-	int err;
-	vcp_raw_t ch0_raw, ch1_raw;
-	int ch0_invalid, ch1_invalid;
+	size_t total = 0;
 
 	IF_ENABLED(CONFIG_ALUDEL_BATTERY_MONITOR, (
 		read_and_report_battery(client);
@@ -345,133 +622,121 @@ void app_sensors_read_and_stream(void)
 		));
 	));
 
-	/* Fetch new readings from sensors */
-	get_adc_reading(&adc_ch0);
-	get_adc_reading(&adc_ch1);
+	IF_ENABLED(CONFIG_APP_STREAM_TS_BLOCK, (
+		for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+			drain_channel(adc_nodes[i]);
+		}
+	));
+
+	/* Take the window and start a new one */
+	k_spinlock_key_t key = k_spin_lock(&window_lock);
 
-	/* Get raw readings from the sensor api */
-	ch0_invalid = get_raw_sensor_values(&adc_ch0, &ch0_raw, false);
-	ch1_invalid = get_raw_sensor_values(&adc_ch1, &ch1_raw, false);
+	for (size_t i = 0; i < ARRAY_SIZE(windows); i++) {
+		window_snap[i] = windows[i];
+		window_reset(&windows[i]);
+		total += window_snap[i].count;
+	}
+
+	k_spin_unlock(&window_lock, key);
 
-	if (ch0_invalid && ch1_invalid) {
+	if (total == 0) {
 		LOG_WRN("Data not available from any sensor");
 		return;
 	}
 
-	/* Log the readings */
-	log_sensor_values(&adc_ch0, false);
-	log_sensor_values(&adc_ch1, false);
+	for (size_t i = 0; i < ARRAY_SIZE(window_snap); i++) {
+		window_summarize(&window_snap[i], &reports[i]);
+	}
 
-	/* Calculate the "On" time if readings are not zero */
-	if (!ch0_invalid) {
-		err = update_ontime(ch0_raw.current, &adc_ch0);
-		if (err) {
-			LOG_ERR("Failed up update ontime: %d", err);
+	/* Send window statistics to Golioth */
+	if (reports_changed()) {
+		if (IS_ENABLED(CONFIG_APP_STREAM_BATCH)) {
+			app_batch_add(reports, ARRAY_SIZE(reports));
+		} else {
+			push_reports_to_golioth();
 		}
+
+		memcpy(last_reports, reports, sizeof(last_reports));
+		last_report_time = k_uptime_get();
+	} else {
+		LOG_DBG("Readings within deadband; report skipped");
 	}
-	if (!ch1_invalid) {
-		err = update_ontime(ch1_raw.current, &adc_ch1);
+
+	report_counters();
+}
+
+void app_sensors_request_flush(void)
+{
+	IF_ENABLED(CONFIG_APP_STREAM_BATCH, (app_batch_flush();));
+	IF_ENABLED(CONFIG_APP_STREAM_TS_BLOCK, (app_ts_block_flush();));
+}
+
+int app_sensors_set_attr(enum sensor_attribute attr, int32_t value)
+{
+	struct sensor_value val = { .val1 = value };
+	int ret = 0;
+	int err;
+
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		err = sensor_attr_set(adc_nodes[i]->dev, SENSOR_CHAN_ALL, attr, &val);
 		if (err) {
-			LOG_ERR("Failed up update ontime: %d", err);
+			LOG_ERR("Unable to set attribute %d on %s: %d", attr,
+				adc_nodes[i]->dev->name, err);
+			ret = ret ? ret : err;
 		}
 	}
-	LOG_DBG("Ontime:\t(ch0): %lld\t(ch1): %lld", adc_ch0.runtime, adc_ch1.runtime);
 
-	/* Send sensor data to Golioth */
-	if (!ch0_invalid && !ch1_invalid) {
-		push_dual_adc_to_golioth(&ch0_raw, &ch1_raw);
-	} else if (!ch0_invalid) {
-		push_single_adc_to_golioth(&ch0_raw, CH0_PATH);
-	} else if (!ch1_invalid) {
-		push_single_adc_to_golioth(&ch1_raw, CH1_PATH);
-	}
+	return ret;
 }
 
-static void get_cumulative_handler(struct golioth_client *client,
-				  const struct golioth_response *response,
-				  const char *path,
-				  const uint8_t *payload,
-				  size_t payload_size,
-				  void *arg)
+void app_sensors_load_cumulative(const uint64_t *totals, uint32_t found)
 {
-	if (response->status != GOLIOTH_OK) {
-		LOG_ERR("Failed to receive cumulative value: %d", response->status);
-		return;
+	/* Channels added since the totals were last stored start from zero */
+	if (found != BIT_MASK(ADC_NUM_CHANNELS)) {
+		LOG_WRN("Cumulative value found for %d of %d channels", popcount(found),
+			ADC_NUM_CHANNELS);
 	}
 
-	if ((payload_size == 1) && (payload[0] == 0xf6)) {
-		/* 0xf6 is Null in CBOR */
-		if (k_sem_take(&adc_data_sem, K_MSEC(300)) == 0) {
-			adc_ch0.loaded_from_cloud = true;
-			adc_ch1.loaded_from_cloud = true;
-			k_sem_give(&adc_data_sem);
-		}
-		return;
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		LOG_DBG("Decoded: ch%d: %lld", (int)i, totals[i]);
 	}
 
-	uint64_t decoded_ch0 = 0;
-	uint64_t decoded_ch1 = 0;
-	bool found_ch0 = 0;
-	bool found_ch1 = 0;
+	k_spinlock_key_t key = counters_write_begin();
 
-	struct zcbor_string key;
-	uint64_t data;
-	bool ok;
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		uint64_t cloud = (found & BIT(i)) ? totals[i] : 0;
 
-	ZCBOR_STATE_D(decoding_state, 1, payload, payload_size, 1, NULL);
-	ok = zcbor_map_start_decode(decoding_state);
-	if (!ok) {
-		goto cumulative_decode_error;
+		/* Totals only grow, so a checkpoint ahead of the cloud holds time it never got */
+		adc_nodes[i]->counters.total_cloud = MAX(cloud, adc_nodes[i]->counters.total_cloud);
+		adc_nodes[i]->counters.loaded_from_cloud = true;
 	}
 
-	while (decoding_state->elem_count > 1) {
-		ok = zcbor_tstr_decode(decoding_state, &key) &&
-		     zcbor_uint64_decode(decoding_state, &data);
-		if (!ok) {
-			goto cumulative_decode_error;
-		}
+	counters_write_end(key);
+}
 
-		if (strncmp(key.value, "ch0", 3) == 0) {
-			found_ch0 = true;
-			decoded_ch0 = data;
-		} else if (strncmp(key.value, "ch1", 3) == 0){
-			found_ch1 = true;
-			decoded_ch1 = data;
-		} else {
-			continue;
-		}
-	}
+/* Start from the last checkpoint; the cloud totals are merged in when they arrive */
+static void restore_counters(void)
+{
+	struct app_checkpoint checkpoint;
+	int err;
 
-	if ((found_ch0 && found_ch1) == false) {
-		goto cumulative_decode_error;
-	} else {
-		LOG_DBG("Decoded: ch0: %lld, ch1: %lld", decoded_ch0, decoded_ch1);
-		if (k_sem_take(&adc_data_sem, K_MSEC(300)) == 0) {
-			adc_ch0.total_cloud = decoded_ch0;
-			adc_ch1.total_cloud = decoded_ch1;
-			adc_ch0.loaded_from_cloud = true;
-			adc_ch1.loaded_from_cloud = true;
-			k_sem_give(&adc_data_sem);
+	err = app_checkpoint_load(&checkpoint);
+	if (err) {
+		if (err != -ENOENT) {
+			LOG_ERR("Unable to load checkpoint: %d", err);
 		}
 		return;
 	}
 
-cumulative_decode_error:
-	LOG_ERR("ZCBOR Decoding Error");
-	LOG_HEXDUMP_ERR(payload, payload_size, "cbor_payload");
-}
+	k_spinlock_key_t key = counters_write_begin();
 
-void app_work_on_connect(void)
-{
-	/* Get cumulative "on" time from Golioth LightDB State */
-	int err = golioth_lightdb_get_async(client,
-					    ADC_CUMULATIVE_ENDP,
-					    GOLIOTH_CONTENT_TYPE_CBOR,
-					    get_cumulative_handler,
-					    NULL);
-	if (err) {
-		LOG_WRN("failed to get cumulative channel data from LightDB: %d", err);
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		adc_nodes[i]->counters.total_cloud = checkpoint.cumulative[i];
+		adc_nodes[i]->counters.energy_acc = checkpoint.energy_acc[i];
+		adc_nodes[i]->counters.charge_acc = checkpoint.charge_acc[i];
 	}
+
+	counters_write_end(key);
 }
 
 void app_sensors_set_client(struct golioth_client *sensors_client)
@@ -481,16 +746,28 @@ void app_sensors_set_client(struct golioth_client *sensors_client)
 
 void app_sensors_init(void)
 {
-	k_sem_init(&adc_data_sem, 0, 1);
+	int err;
 
-	if (device_is_ready(adc_ch0.dev)) {
-		get_adc_reading(&adc_ch0);
+	for (size_t i = 0; i < ARRAY_SIZE(adc_nodes); i++) {
+		adc_nodes[i]->ch_num = i;
+		window_reset(&windows[i]);
+
+		if (!device_is_ready(adc_nodes[i]->dev)) {
+			LOG_ERR("Device %s is not ready", adc_nodes[i]->dev->name);
+		}
 	}
 
-	if (device_is_ready(adc_ch1.dev)) {
-		get_adc_reading(&adc_ch1);
+	restore_counters();
+
+	app_alert_init(adc_nodes, ARRAY_SIZE(adc_nodes));
+
+	/* Floors, deadbands, alerts and INA260 configuration from the last boot */
+	app_settings_load();
+
+	err = app_sampler_start(adc_nodes, ARRAY_SIZE(adc_nodes));
+	if (err) {
+		LOG_ERR("Unable to start sampler: %d", err);
 	}
 
-	/* Semaphores to handle data access */
-	k_sem_give(&adc_data_sem);
+	app_checkpoint_start();
 }
@@ -8,38 +8,144 @@
 #define __APP_SENSORS_H__
 
 #include <stdint.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/sensor.h>
 #include <zephyr/drivers/spi.h>
 #include <golioth/client.h>
 
-extern struct k_sem adc_data_sem;
+/* One channel per enabled ti,ina260 node, numbered by its channel property */
+#define ADC_NUM_CHANNELS DT_NUM_INST_STATUS_OKAY(ti_ina260)
 
-struct ontime {
-	uint64_t ch0;
-	uint64_t ch1;
-};
+BUILD_ASSERT(ADC_NUM_CHANNELS > 0, "No ti,ina260 nodes are enabled in devicetree");
 
 typedef struct {
-	const struct  device *const dev;
-	uint8_t ch_num;
-	int64_t laston;
+	int16_t current;
+	int16_t voltage;
+	uint16_t power;
+} vcp_raw_t;
+
+/**
+ * Counters of one channel shared with the Golioth client.
+ *
+ * Updates are published with a sequence lock covering every channel; use
+ * app_sensors_get_counters() to read a consistent copy.
+ */
+struct adc_counters {
 	uint64_t runtime;
 	uint64_t total_unreported;
+	/* Sent to LightDB State, waiting for the write to be acknowledged */
+	uint64_t total_inflight;
 	uint64_t total_cloud;
+	/* Sum of (P[n-1] + P[n]) * dt in raw power LSBs times ticks */
+	uint64_t energy_acc;
+	/* Sum of (I[n-1] + I[n]) * dt in raw current LSBs times ticks */
+	int64_t charge_acc;
 	bool loaded_from_cloud;
+};
+
+typedef struct {
+	const struct  device *const dev;
+	/* I2C controller, used to share a sampler thread between its channels */
+	const struct device *const bus;
+	uint8_t ch_num;
+	struct adc_counters counters;
+	/*
+	 * Uptime in milliseconds of the last sample with the channel on, or -1.
+	 * This and the fields below are only used by the accounting thread
+	 * (account_frame()).
+	 */
+	int64_t laston;
+	/* Previous sample, used for trapezoidal energy integration */
+	int64_t last_ts;
+	vcp_raw_t last_raw;
 	bool device_ready;
+#ifdef CONFIG_APP_SAMPLER_RTIO
+	/* Read request for the raw channels, used by the sampler */
+	struct rtio_iodev *iodev;
+#endif
 } adc_node_t;
 
-typedef struct {
-	int16_t current;
-	int16_t voltage;
-	uint16_t power;
-} vcp_raw_t;
+/** Quantities measured on every channel */
+enum vcp_quantity {
+	VCP_CURRENT,
+	VCP_VOLTAGE,
+	VCP_POWER,
+	VCP_NUM_QUANTITIES
+};
 
-void get_ontime(struct ontime *ot);
+/** Integer accumulator for one quantity over a report window */
+struct vcp_stat {
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	uint64_t sum_sq;
+};
+
+/** Statistics of every sample taken on one channel during a report window */
+struct vcp_window {
+	uint32_t count;
+	struct vcp_stat cur;
+	struct vcp_stat vol;
+	struct vcp_stat pow;
+};
+
+/** Summary of one quantity over a report window, in raw INA260 units */
+struct vcp_summary {
+	int32_t min;
+	int32_t max;
+	int32_t mean;
+	uint32_t rms;
+};
+
+/** Summary of one channel over a report window; no samples were taken if count is 0 */
+struct vcp_report {
+	uint32_t count;
+	struct vcp_summary cur;
+	struct vcp_summary vol;
+	struct vcp_summary pow;
+};
+
+/**
+ * @brief Copy the counters of every channel without blocking
+ *
+ * @param out Array of ADC_NUM_CHANNELS entries, indexed by channel number
+ */
+void app_sensors_get_counters(struct adc_counters *out);
+int64_t adc_energy_mwh(const struct adc_counters *counters);
+int64_t adc_charge_mah(const struct adc_counters *counters);
 int reset_cumulative_totals(void);
-void app_work_on_connect(void);
+
+/**
+ * @brief Set the cumulative totals received from LightDB State
+ *
+ * A total restored from a local checkpoint is kept if it is larger.
+ *
+ * @param totals Array of ADC_NUM_CHANNELS totals, indexed by channel number
+ * @param found Bit per channel present in @p totals; the others are set to zero
+ */
+void app_sensors_load_cumulative(const uint64_t *totals, uint32_t found);
+
+/**
+ * @brief Commit or return the on-time sent with a state write
+ *
+ * On-time moves to total_cloud only once the write is acknowledged; if it
+ * failed it is added back to total_unreported and sent with the next write.
+ * Results for anything but the write in flight are ignored.
+ *
+ * @param seq Sequence number of the write
+ * @param acked True if Golioth acknowledged the write
+ */
+void app_sensors_report_done(uint32_t seq, bool acked);
 void app_sensors_set_client(struct golioth_client *sensors_client);
 void app_sensors_read_and_stream(void);
+void app_sensors_request_flush(void);
+
+/**
+ * @brief Set a sensor attribute on every INA260 channel
+ *
+ * @return 0 on success, or the first error returned by the driver
+ */
+int app_sensors_set_attr(enum sensor_attribute attr, int32_t value);
 void app_sensors_init(void);
 
 
@@ -47,30 +153,26 @@ void app_sensors_init(void);
 #define LABEL_BATTERY	 "Battery"
 #define LABEL_FIRMWARE	 "Firmware"
 #define SUMMARY_TITLE	 "Channel 0:"
-#define CH0_CUR_LABEL "Current ch0"
-#define CH0_VOL_LABEL "Voltage ch0"
-#define CH0_POW_LABEL "Power ch0"
-#define CH1_CUR_LABEL "Current ch1"
-#define CH1_VOL_LABEL "Voltage ch1"
-#define CH1_POW_LABEL "Power ch1"
+#define CUR_LABEL	 "Current"
+#define VOL_LABEL	 "Voltage"
+#define POW_LABEL	 "Power"
 
 
 /**
  * Each Ostentus slide needs a unique key. You may add additional slides by
- * inserting elements with the name of your choice to this enum.
+ * inserting elements with the name of your choice to this enum. Channel slides
+ * follow the last entry; use CH_SLIDE() to get their keys.
  */
 typedef enum {
-	CH0_CURRENT,
-	CH0_POWER,
-	CH0_VOLTAGE,
-	CH1_CURRENT,
-	CH1_POWER,
-	CH1_VOLTAGE,
 #ifdef CONFIG_ALUDEL_BATTERY_MONITOR
 	BATTERY_V,
 	BATTERY_LVL,
 #endif
-	FIRMWARE
+	FIRMWARE,
+	CH_SLIDE_FIRST
 } slide_key;
 
+/** Key of the slide showing one quantity of a channel */
+#define CH_SLIDE(ch_num, quantity) (CH_SLIDE_FIRST + ((ch_num) * VCP_NUM_QUANTITIES) + (quantity))
+
 #endif /* __APP_SENSORS_H__ */
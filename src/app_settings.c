@@ -7,19 +7,102 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(app_settings, LOG_LEVEL_DBG);
 
+#include <string.h>
 #include <golioth/client.h>
 #include <golioth/settings.h>
+#include <zephyr/settings/settings.h>
 #include "main.h"
 #include "app_settings.h"
+#include "app_alert.h"
+#include "app_event.h"
+
+#include <drivers/sensor/ina260.h>
 
 static int32_t _loop_delay_s = 6;
 #define LOOP_DELAY_S_MAX 43200
 #define LOOP_DELAY_S_MIN 0
 
-static int16_t _adc_floor[2] = { 0, 0 };
+/* Per-channel keys are generated at registration; the longest is "DEADBAND_CUR_CHnn" */
+#define CH_KEY_MAX_LEN sizeof("DEADBAND_CUR_CH00")
+BUILD_ASSERT(ADC_NUM_CHANNELS <= 100, "Per-channel setting keys hold two digits");
+
+static int16_t _adc_floor[ADC_NUM_CHANNELS];
 #define ADC_FLOOR_MAX 32767
 #define ADC_FLOOR_MIN -32768
 
+static char _adc_floor_keys[ADC_NUM_CHANNELS][CH_KEY_MAX_LEN];
+
+static int32_t _deadband[ADC_NUM_CHANNELS][VCP_NUM_QUANTITIES];
+#define DEADBAND_MAX 65535
+#define DEADBAND_MIN 0
+
+static const char *const _deadband_prefixes[VCP_NUM_QUANTITIES] = {
+	[VCP_CURRENT] = "DEADBAND_CUR",
+	[VCP_VOLTAGE] = "DEADBAND_VOL",
+	[VCP_POWER] = "DEADBAND_POW",
+};
+static char _deadband_keys[ADC_NUM_CHANNELS][VCP_NUM_QUANTITIES][CH_KEY_MAX_LEN];
+
+/* Report-on-change is disabled while this is 0 */
+static int32_t _report_heartbeat_s;
+#define REPORT_HEARTBEAT_S_MAX 86400
+#define REPORT_HEARTBEAT_S_MIN 0
+
+/* INA260 configuration, applied to every channel */
+struct ina260_setting {
+	const char *key;
+	enum sensor_attribute attr;
+	int32_t min;
+	int32_t max;
+};
+
+static const struct ina260_setting _ina260_settings[] = {
+	{ "INA260_AVG_COUNT", SENSOR_ATTR_OVERSAMPLING, 1, 1024 },
+	{ "INA260_VBUS_CT_US", (enum sensor_attribute)SENSOR_ATTR_INA260_VBUS_CONVERSION_TIME,
+	  140, 8244 },
+	{ "INA260_ISHUNT_CT_US", (enum sensor_attribute)SENSOR_ATTR_INA260_ISHUNT_CONVERSION_TIME,
+	  140, 8244 },
+	{ "INA260_MODE", (enum sensor_attribute)SENSOR_ATTR_INA260_MODE,
+	  INA260_MODE_SHUTDOWN, INA260_MODE_CONTINUOUS },
+};
+
+static int32_t _alert_func[ADC_NUM_CHANNELS];
+static int32_t _alert_limit[ADC_NUM_CHANNELS];
+#define ALERT_LIMIT_MAX 65535
+#define ALERT_LIMIT_MIN -32768
+
+static char _alert_func_keys[ADC_NUM_CHANNELS][CH_KEY_MAX_LEN];
+static char _alert_limit_keys[ADC_NUM_CHANNELS][CH_KEY_MAX_LEN];
+
+/* LOOP_DELAY_S and REPORT_HEARTBEAT_S, then ADC_FLOOR, DEADBAND_* and ALERT_* per channel */
+#define NUM_SETTINGS \
+	(2 + ARRAY_SIZE(_ina260_settings) + (ADC_NUM_CHANNELS * (1 + VCP_NUM_QUANTITIES + 2)))
+
+BUILD_ASSERT(NUM_SETTINGS <= CONFIG_GOLIOTH_MAX_NUM_SETTINGS,
+	     "Raise CONFIG_GOLIOTH_MAX_NUM_SETTINGS for the number of INA260 channels");
+
+/* Values accepted from the Settings service are stored under this subtree */
+#define SETTINGS_SUBTREE "app/cfg"
+/* The longest key is "INA260_ISHUNT_CT_US" */
+#define SETTINGS_KEY_MAX_LEN sizeof(SETTINGS_SUBTREE "/INA260_ISHUNT_CT_US")
+
+struct app_setting {
+	const char *key;
+	int32_t min;
+	int32_t max;
+	enum golioth_settings_status (*cb)(int32_t new_value, void *arg);
+	void *arg;
+	/* Value saved in flash, or loaded from it at boot */
+	bool stored;
+	int32_t stored_value;
+};
+
+static struct app_setting _settings[NUM_SETTINGS];
+static size_t _num_settings;
+
+/* Pack a channel and quantity into a settings callback argument */
+#define DEADBAND_ARG(ch, q) ((void *)(uintptr_t)(((ch) * VCP_NUM_QUANTITIES) + (q)))
+
 int32_t get_loop_delay_s(void)
 {
 	return _loop_delay_s;
@@ -27,13 +110,27 @@ int32_t get_loop_delay_s(void)
 
 int16_t get_adc_floor(uint8_t ch_num)
 {
-	if (ch_num >= sizeof(_adc_floor)) {
+	if (ch_num >= ARRAY_SIZE(_adc_floor)) {
 		return 0;
 	} else {
 		return _adc_floor[ch_num];
 	}
 }
 
+int32_t get_deadband(uint8_t ch_num, enum vcp_quantity quantity)
+{
+	if ((ch_num >= ADC_NUM_CHANNELS) || (quantity >= VCP_NUM_QUANTITIES)) {
+		return 0;
+	}
+
+	return _deadband[ch_num][quantity];
+}
+
+int32_t get_report_heartbeat_s(void)
+{
+	return _report_heartbeat_s;
+}
+
 static enum golioth_settings_status on_loop_delay_setting(int32_t new_value, void *arg)
 {
 	/* Only update if value has changed */
@@ -50,55 +147,294 @@ static enum golioth_settings_status on_loop_delay_setting(int32_t new_value, voi
 
 static enum golioth_settings_status on_adc_floor_setting(int32_t new_value, void *arg)
 {
-	uint8_t ch_num = (int)arg;
+	uint8_t ch_num = (uintptr_t)arg;
 
 	/* Only update if value has changed */
 	if (_adc_floor[ch_num] == new_value) {
-		LOG_DBG("Received ADC_FLOOR_CH%d already matches local value.", ch_num);
+		LOG_DBG("Received %s already matches local value.", _adc_floor_keys[ch_num]);
 		return GOLIOTH_SETTINGS_SUCCESS;
 	}
 
 	_adc_floor[ch_num] = new_value;
-	LOG_INF("Set ADC_FLOOR_CH%d to %d", ch_num, _adc_floor[ch_num]);
+	LOG_INF("Set %s to %d", _adc_floor_keys[ch_num], _adc_floor[ch_num]);
 	wake_system_thread();
 	return GOLIOTH_SETTINGS_SUCCESS;
 }
 
-void app_settings_register(struct golioth_client *client)
+static enum golioth_settings_status on_deadband_setting(int32_t new_value, void *arg)
 {
+	uintptr_t idx = (uintptr_t)arg;
+	uint8_t ch_num = idx / VCP_NUM_QUANTITIES;
+	uint8_t quantity = idx % VCP_NUM_QUANTITIES;
+
+	if (_deadband[ch_num][quantity] == new_value) {
+		LOG_DBG("Received %s already matches local value.", _deadband_keys[ch_num][quantity]);
+		return GOLIOTH_SETTINGS_SUCCESS;
+	}
+
+	_deadband[ch_num][quantity] = new_value;
+	LOG_INF("Set %s to %d", _deadband_keys[ch_num][quantity], new_value);
+	return GOLIOTH_SETTINGS_SUCCESS;
+}
+
+static enum golioth_settings_status on_report_heartbeat_setting(int32_t new_value, void *arg)
+{
+	if (_report_heartbeat_s == new_value) {
+		LOG_DBG("Received REPORT_HEARTBEAT_S already matches local value.");
+		return GOLIOTH_SETTINGS_SUCCESS;
+	}
+
+	_report_heartbeat_s = new_value;
+	LOG_INF("Set report heartbeat to %d seconds%s", new_value,
+		new_value ? "" : " (report-on-change disabled)");
+	return GOLIOTH_SETTINGS_SUCCESS;
+}
+
+static enum golioth_settings_status on_ina260_setting(int32_t new_value, void *arg)
+{
+	const struct ina260_setting *setting = arg;
 	int err;
-	struct golioth_settings *settings = golioth_settings_init(client);
 
-	err = golioth_settings_register_int_with_range(settings,
-							   "LOOP_DELAY_S",
-							   LOOP_DELAY_S_MIN,
-							   LOOP_DELAY_S_MAX,
-							   on_loop_delay_setting,
-							   NULL);
+	err = app_sensors_set_attr(setting->attr, new_value);
+	if (err == -EINVAL) {
+		/* Within range but not a value the INA260 supports */
+		LOG_ERR("%s does not support %d", setting->key, new_value);
+		return GOLIOTH_SETTINGS_VALUE_FORMAT_NOT_VALID;
+	} else if (err) {
+		return GOLIOTH_SETTINGS_GENERAL_ERROR;
+	}
 
-	if (err) {
-		LOG_ERR("Failed to register loop delay settings callback: %d", err);
+	LOG_INF("Set %s to %d", setting->key, new_value);
+	return GOLIOTH_SETTINGS_SUCCESS;
+}
+
+static enum golioth_settings_status apply_alert(uint8_t ch_num, int32_t func, int32_t limit)
+{
+	int err = app_alert_configure(ch_num, func, limit);
+
+	if (err == -EINVAL) {
+		/* Limit is out of range for the quantity, e.g. negative voltage */
+		return GOLIOTH_SETTINGS_VALUE_OUTSIDE_RANGE;
+	} else if (err) {
+		return GOLIOTH_SETTINGS_GENERAL_ERROR;
 	}
 
-	err = golioth_settings_register_int_with_range(settings,
-							   "ADC_FLOOR_CH0",
-							   ADC_FLOOR_MIN,
-							   ADC_FLOOR_MAX,
-							   on_adc_floor_setting,
-							   (void *)0);
+	/* Cached only once programmed, so a rejected value is neither kept nor saved */
+	_alert_func[ch_num] = func;
+	_alert_limit[ch_num] = limit;
 
+	return GOLIOTH_SETTINGS_SUCCESS;
+}
+
+static enum golioth_settings_status on_alert_func_setting(int32_t new_value, void *arg)
+{
+	uint8_t ch_num = (uintptr_t)arg;
+
+	if (_alert_func[ch_num] == new_value) {
+		LOG_DBG("Received %s already matches local value.", _alert_func_keys[ch_num]);
+		return GOLIOTH_SETTINGS_SUCCESS;
+	}
+
+	return apply_alert(ch_num, new_value, _alert_limit[ch_num]);
+}
+
+static enum golioth_settings_status on_alert_limit_setting(int32_t new_value, void *arg)
+{
+	uint8_t ch_num = (uintptr_t)arg;
+
+	if (_alert_limit[ch_num] == new_value) {
+		LOG_DBG("Received %s already matches local value.", _alert_limit_keys[ch_num]);
+		return GOLIOTH_SETTINGS_SUCCESS;
+	}
+
+	/* Nothing to program until a limit function is selected */
+	if (_alert_func[ch_num] == APP_ALERT_NONE) {
+		_alert_limit[ch_num] = new_value;
+		return GOLIOTH_SETTINGS_SUCCESS;
+	}
+
+	return apply_alert(ch_num, _alert_func[ch_num], new_value);
+}
+
+static void add_setting(const char *key, int32_t min, int32_t max,
+			enum golioth_settings_status (*cb)(int32_t new_value, void *arg), void *arg)
+{
+	__ASSERT_NO_MSG(_num_settings < ARRAY_SIZE(_settings));
+
+	_settings[_num_settings++] = (struct app_setting){
+		.key = key,
+		.min = min,
+		.max = max,
+		.cb = cb,
+		.arg = arg,
+	};
+}
+
+/* Build the table of settings once; keys are generated per channel */
+static void init_settings(void)
+{
+	if (_num_settings > 0) {
+		return;
+	}
+
+	add_setting("LOOP_DELAY_S", LOOP_DELAY_S_MIN, LOOP_DELAY_S_MAX,
+		    on_loop_delay_setting, NULL);
+	add_setting("REPORT_HEARTBEAT_S", REPORT_HEARTBEAT_S_MIN, REPORT_HEARTBEAT_S_MAX,
+		    on_report_heartbeat_setting, NULL);
+
+	for (uint8_t ch = 0; ch < ADC_NUM_CHANNELS; ch++) {
+		snprintk(_adc_floor_keys[ch], CH_KEY_MAX_LEN, "ADC_FLOOR_CH%d", ch);
+		add_setting(_adc_floor_keys[ch], ADC_FLOOR_MIN, ADC_FLOOR_MAX,
+			    on_adc_floor_setting, (void *)(uintptr_t)ch);
+
+		for (uint8_t q = 0; q < VCP_NUM_QUANTITIES; q++) {
+			snprintk(_deadband_keys[ch][q], CH_KEY_MAX_LEN, "%s_CH%d",
+				 _deadband_prefixes[q], ch);
+			add_setting(_deadband_keys[ch][q], DEADBAND_MIN, DEADBAND_MAX,
+				    on_deadband_setting, DEADBAND_ARG(ch, q));
+		}
+	}
+
+	/* Limits come first, so restoring a function programs it with its limit */
+	for (uint8_t ch = 0; ch < ADC_NUM_CHANNELS; ch++) {
+		snprintk(_alert_func_keys[ch], CH_KEY_MAX_LEN, "ALERT_FUNC_CH%d", ch);
+		snprintk(_alert_limit_keys[ch], CH_KEY_MAX_LEN, "ALERT_LIMIT_CH%d", ch);
+
+		add_setting(_alert_limit_keys[ch], ALERT_LIMIT_MIN, ALERT_LIMIT_MAX,
+			    on_alert_limit_setting, (void *)(uintptr_t)ch);
+		add_setting(_alert_func_keys[ch], APP_ALERT_NONE, APP_ALERT_NUM_FUNCS - 1,
+			    on_alert_func_setting, (void *)(uintptr_t)ch);
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(_ina260_settings); i++) {
+		add_setting(_ina260_settings[i].key, _ina260_settings[i].min,
+			    _ina260_settings[i].max, on_ina260_setting,
+			    (void *)&_ina260_settings[i]);
+	}
+}
+
+/* Apply a value from the Settings service and keep it for the next boot if accepted */
+static enum golioth_settings_status on_setting(int32_t new_value, void *arg)
+{
+	struct app_setting *setting = arg;
+	enum golioth_settings_status status = setting->cb(new_value, setting->arg);
+	struct app_event event = {
+		.type = APP_EVENT_SAVE_SETTING,
+		.setting = {
+			.index = setting - _settings,
+			.value = new_value,
+		},
+	};
+
+	if ((status == GOLIOTH_SETTINGS_SUCCESS) &&
+	    (!setting->stored || (setting->stored_value != new_value))) {
+		/* Written to flash on the event thread, not the Golioth client thread */
+		app_event_post(&event);
+	}
+
+	return status;
+}
+
+void app_settings_save(uint16_t index, int32_t value)
+{
+	struct app_setting *setting;
+	char key[SETTINGS_KEY_MAX_LEN];
+	int err;
+
+	if (index >= _num_settings) {
+		return;
+	}
+
+	setting = &_settings[index];
+	if (setting->stored && (setting->stored_value == value)) {
+		return;
+	}
+
+	snprintk(key, sizeof(key), SETTINGS_SUBTREE "/%s", setting->key);
+
+	err = settings_save_one(key, &value, sizeof(value));
 	if (err) {
-		LOG_ERR("Failed to register ADC_FLOOR_CH0 settings callback: %d", err);
+		LOG_ERR("Unable to save %s: %d", setting->key, err);
+		return;
+	}
+
+	setting->stored = true;
+	setting->stored_value = value;
+}
+
+static int load_setting(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg,
+			void *param)
+{
+	int32_t value;
+
+	if ((len != sizeof(value)) || (read_cb(cb_arg, &value, sizeof(value)) != sizeof(value))) {
+		LOG_WRN("Ignoring stored setting %s of %d bytes", key, (int)len);
+		return 0;
+	}
+
+	for (size_t i = 0; i < _num_settings; i++) {
+		if (strcmp(key, _settings[i].key) == 0) {
+			_settings[i].stored = true;
+			_settings[i].stored_value = value;
+			return 0;
+		}
 	}
 
-	err = golioth_settings_register_int_with_range(settings,
-							   "ADC_FLOOR_CH1",
-							   ADC_FLOOR_MIN,
-							   ADC_FLOOR_MAX,
-							   on_adc_floor_setting,
-							   (void *)1);
+	/* A channel that no longer exists, or a setting that was removed */
+	LOG_DBG("Ignoring stored setting %s", key);
+	return 0;
+}
+
+void app_settings_load(void)
+{
+	int err;
+
+	init_settings();
 
+	err = settings_subsys_init();
+	if (!err) {
+		err = settings_load_subtree_direct(SETTINGS_SUBTREE, load_setting, NULL);
+	}
 	if (err) {
-		LOG_ERR("Failed to register ADC_FLOOR_CH1 settings callback: %d", err);
+		LOG_ERR("Unable to load stored settings: %d", err);
+		return;
+	}
+
+	/* Applied in table order, so each value sees the ones it depends on */
+	for (size_t i = 0; i < _num_settings; i++) {
+		struct app_setting *setting = &_settings[i];
+
+		if (!setting->stored) {
+			continue;
+		}
+
+		if ((setting->stored_value < setting->min) ||
+		    (setting->stored_value > setting->max) ||
+		    (setting->cb(setting->stored_value, setting->arg) !=
+		     GOLIOTH_SETTINGS_SUCCESS)) {
+			LOG_WRN("Stored %s of %d not applied", setting->key, setting->stored_value);
+		}
+	}
+}
+
+void app_settings_register(struct golioth_client *client)
+{
+	int err;
+	struct golioth_settings *settings = golioth_settings_init(client);
+
+	init_settings();
+
+	for (size_t i = 0; i < _num_settings; i++) {
+		err = golioth_settings_register_int_with_range(settings,
+							       _settings[i].key,
+							       _settings[i].min,
+							       _settings[i].max,
+							       on_setting,
+							       &_settings[i]);
+
+		if (err) {
+			LOG_ERR("Failed to register %s settings callback: %d",
+				_settings[i].key, err);
+		}
 	}
 }
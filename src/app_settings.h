@@ -12,6 +12,17 @@
  * Settings Service and uses this value to determine the delay between sensor
  * reads (the period of sleep in the loop of `main.c`.
  *
+ * When `REPORT_HEARTBEAT_S` is non-zero, sensor reports are only streamed when
+ * a reading leaves the `DEADBAND_*` range around the last streamed mean, or
+ * when no report has been streamed for `REPORT_HEARTBEAT_S` seconds.
+ *
+ * The `INA260_*` keys override the devicetree configuration of every INA260.
+ *
+ * Every value accepted from the Settings Service is also saved with the Zephyr
+ * settings subsystem and applied at boot, before sampling starts, so the
+ * device does not run on compiled-in defaults until it connects. Values
+ * received from the cloud replace the stored ones.
+ *
  * https://docs.golioth.io/firmware/zephyr-device-sdk/device-settings-service
  */
 
@@ -20,9 +31,25 @@
 
 #include <stdint.h>
 #include <golioth/client.h>
+#include "app_sensors.h"
 
 int32_t get_loop_delay_s(void);
 int16_t get_adc_floor(uint8_t ch_num);
+int32_t get_deadband(uint8_t ch_num, enum vcp_quantity quantity);
+int32_t get_report_heartbeat_s(void);
 void app_settings_register(struct golioth_client *client);
 
+/** @brief Apply the values saved by a previous boot */
+void app_settings_load(void);
+
+/**
+ * @brief Save a value accepted from the Settings Service
+ *
+ * Called on the event thread, so flash writes do not hold up the Golioth client.
+ *
+ * @param index Index of the setting, as posted with APP_EVENT_SAVE_SETTING
+ * @param value Accepted value
+ */
+void app_settings_save(uint16_t index, int32_t value);
+
 #endif /* __APP_SETTINGS_H__ */
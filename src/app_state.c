@@ -7,19 +7,19 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(app_state, LOG_LEVEL_DBG);
 
+#include <stdlib.h>
 #include <golioth/client.h>
 #include <golioth/lightdb_state.h>
 #include <zcbor_encode.h>
 #include <zcbor_decode.h>
 #include <zephyr/kernel.h>
 
+#include "app_cumulative.h"
+#include "app_encode.h"
+#include "app_event.h"
 #include "app_state.h"
 #include "app_sensors.h"
 
-#define LIVE_RUNTIME_FMT "{\"live_runtime\":{\"ch0\":%lld,\"ch1\":%lld}"
-#define CUMULATIVE_RUNTIME_FMT ",\"cumulative\":{\"ch0\":%lld,\"ch1\":%lld}}"
-#define DEVICE_STATE_FMT LIVE_RUNTIME_FMT "}"
-#define DEVICE_STATE_FMT_CUMULATIVE LIVE_RUNTIME_FMT CUMULATIVE_RUNTIME_FMT
 #define DESIRED_RESET_KEY "reset_cumulative"
 
 uint32_t _example_int0;
@@ -27,7 +27,19 @@ uint32_t _example_int1 = 1;
 
 static struct golioth_client *client;
 
-static struct ontime ot;
+static uint8_t state_buf[APP_ENCODE_STATE_MAX_SIZE];
+static K_MUTEX_DEFINE(state_buf_mutex);
+
+/* Last state written, used to skip writes that would change nothing meaningful */
+static struct app_state_report last_sent;
+static int64_t last_sync;
+static bool sync_pending = true;
+
+/* LightDB State is not queued offline; the counters stay local until connected */
+static bool client_connected(void)
+{
+	return client && golioth_client_is_connected(client);
+}
 
 static void async_handler(struct golioth_client *client,
 				       const struct golioth_response *response,
@@ -42,6 +54,26 @@ static void async_handler(struct golioth_client *client,
 	LOG_DBG("State successfully set");
 }
 
+static void state_ack_handler(struct golioth_client *client,
+			      const struct golioth_response *response,
+			      const char *path,
+			      void *arg)
+{
+	struct app_event event = {
+		.type = APP_EVENT_STATE_ACK,
+		.state_ack = {
+			.seq = (uint32_t)(uintptr_t)arg,
+			.acked = (response->status == GOLIOTH_OK),
+		},
+	};
+
+	if (!event.state_ack.acked) {
+		LOG_WRN("Failed to set state %u: %d", event.state_ack.seq, response->status);
+	}
+
+	app_event_post(&event);
+}
+
 /* Forward declaration */
 static void app_state_desired_handler(struct golioth_client *client,
 				      const struct golioth_response *response,
@@ -55,6 +87,10 @@ int app_state_reset_desired(void)
 	uint8_t cbor_payload[32];
 	bool ok;
 
+	if (!client_connected()) {
+		return -ENOTCONN;
+	}
+
 	ZCBOR_STATE_E(encoding_state, 16, cbor_payload, sizeof(cbor_payload), 0);
 	ok = zcbor_map_start_encode(encoding_state, 2) &&
 	     zcbor_tstr_put_lit(encoding_state, DESIRED_RESET_KEY) &&
@@ -104,80 +140,122 @@ int app_state_observe(struct golioth_client *state_client)
 	return err;
 }
 
-int app_state_update_actual(void)
+/* Encode and send the state; caller must hold state_buf_mutex */
+static int send_state(const struct app_state_report *state)
 {
-	get_ontime(&ot);
-	char sbuf[sizeof(DEVICE_STATE_FMT) + 10]; /* space for uint16 values */
-
-	snprintk(sbuf, sizeof(sbuf), DEVICE_STATE_FMT, ot.ch0, ot.ch1);
-
+	int len;
 	int err;
 
+	len = app_encode_state(state_buf, sizeof(state_buf), state);
+	if (len < 0) {
+		return len;
+	}
+
 	err = golioth_lightdb_set_async(client,
 					APP_STATE_ACTUAL_ENDP,
-					GOLIOTH_CONTENT_TYPE_JSON,
-					sbuf,
-					strlen(sbuf),
-					async_handler,
-					NULL);
-
+					GOLIOTH_CONTENT_TYPE_CBOR,
+					state_buf,
+					len,
+					state_ack_handler,
+					(void *)(uintptr_t)state->seq);
 	if (err) {
 		LOG_ERR("Unable to write to LightDB State: %d", err);
 	}
 	return err;
 }
 
-int app_state_report_ontime(adc_node_t *ch0, adc_node_t *ch1)
+int app_state_update_actual(void)
 {
-	int err;
-	char json_buf[128];
-
-	if (k_sem_take(&adc_data_sem, K_MSEC(300)) == 0) {
-
-		if (ch0->loaded_from_cloud) {
-			snprintk(json_buf,
-				 sizeof(json_buf),
-				 DEVICE_STATE_FMT_CUMULATIVE,
-				 ch0->runtime,
-				 ch1->runtime,
-				 ch0->total_cloud + ch0->total_unreported,
-				 ch1->total_cloud + ch1->total_unreported);
-		} else {
-			snprintk(json_buf,
-				 sizeof(json_buf),
-				 DEVICE_STATE_FMT,
-				 ch0->runtime,
-				 ch1->runtime);
-			/* Cumulative not yet loaded from LightDB State */
-			/* Try to load it now */
-			app_work_on_connect();
+	/* Merged into the next report instead of sending a partial state */
+	k_mutex_lock(&state_buf_mutex, K_FOREVER);
+	sync_pending = true;
+	k_mutex_unlock(&state_buf_mutex);
+
+	return 0;
+}
+
+static bool moved_by(int64_t value, int64_t sent, int64_t delta)
+{
+	return llabs(value - sent) >= delta;
+}
+
+/* Caller must hold state_buf_mutex */
+static bool state_changed(const struct app_state_report *state)
+{
+	if (state->has_cumulative != last_sent.has_cumulative) {
+		return true;
+	}
+
+	for (size_t i = 0; i < ADC_NUM_CHANNELS; i++) {
+		/* Channel turned on or off */
+		if ((state->live_runtime[i] == 0) != (last_sent.live_runtime[i] == 0)) {
+			return true;
 		}
 
-		err = golioth_lightdb_set_async(client,
-						APP_STATE_ACTUAL_ENDP,
-						GOLIOTH_CONTENT_TYPE_JSON,
-						json_buf,
-						strlen(json_buf),
-						async_handler,
-						NULL);
-		if (err) {
-			LOG_ERR("Failed to send sensor data to Golioth: %d", err);
-			k_sem_give(&adc_data_sem);
-			return err;
-		} else {
-			if (ch0->loaded_from_cloud) {
-				ch0->total_cloud += ch0->total_unreported;
-				ch0->total_unreported = 0;
-				ch1->total_cloud += ch1->total_unreported;
-				ch1->total_unreported = 0;
-			}
+		/* Counters only go backwards when they are reset */
+		if ((state->cumulative[i] < last_sent.cumulative[i]) ||
+		    moved_by(state->energy_mwh[i], last_sent.energy_mwh[i],
+			     CONFIG_APP_STATE_SYNC_ENERGY_DELTA_MWH) ||
+		    moved_by(state->charge_mah[i], last_sent.charge_mah[i],
+			     CONFIG_APP_STATE_SYNC_CHARGE_DELTA_MAH)) {
+			return true;
 		}
-		k_sem_give(&adc_data_sem);
-	} else {
-		return -EACCES;
 	}
 
-	return 0;
+	return false;
+}
+
+int app_state_report_ontime(const struct adc_counters *counters, size_t count, uint32_t seq)
+{
+	struct app_state_report state = { .seq = seq };
+	int err;
+
+	if (!client_connected()) {
+		/* Unreported time keeps accumulating and is sent once connected */
+		return -ENOTCONN;
+	}
+
+	count = MIN(count, ADC_NUM_CHANNELS);
+
+	/* All channels are loaded from the cloud together */
+	state.has_energy = true;
+	state.has_cumulative = counters[0].loaded_from_cloud;
+
+	for (size_t i = 0; i < count; i++) {
+		state.live_runtime[i] = counters[i].runtime;
+		state.energy_mwh[i] = adc_energy_mwh(&counters[i]);
+		state.charge_mah[i] = adc_charge_mah(&counters[i]);
+		state.cumulative[i] = counters[i].total_cloud + counters[i].total_inflight +
+				      counters[i].total_unreported;
+	}
+
+	if (!state.has_cumulative) {
+		/* Cumulative not yet loaded from LightDB State; no-op while a fetch is running */
+		app_cumulative_fetch();
+	}
+
+	k_mutex_lock(&state_buf_mutex, K_FOREVER);
+
+	if (!sync_pending && !state_changed(&state) &&
+	    (k_uptime_get() - last_sync < CONFIG_APP_STATE_SYNC_MAX_INTERVAL_S * MSEC_PER_SEC)) {
+		k_mutex_unlock(&state_buf_mutex);
+		return -EAGAIN;
+	}
+
+	err = send_state(&state);
+	if (!err) {
+		last_sent = state;
+		last_sync = k_uptime_get();
+		sync_pending = false;
+	}
+
+	k_mutex_unlock(&state_buf_mutex);
+
+	if (err) {
+		LOG_ERR("Failed to send sensor data to Golioth: %d", err);
+	}
+
+	return err;
 }
 
 static void app_state_desired_handler(struct golioth_client *client,
@@ -199,13 +277,16 @@ static void app_state_desired_handler(struct golioth_client *client,
 	if (strncmp(payload, "false", strlen("false")) == 0) {
 		return;
 	} else if (strncmp(payload, "true", strlen("true")) == 0) {
+		struct app_event event = { .type = APP_EVENT_RESET_CUMULATIVE };
+
 		LOG_INF("Request to reset cumulative values received. Processing now.");
-		reset_cumulative_totals();
-		app_state_reset_desired();
+		app_event_post(&event);
 	} else {
+		struct app_event event = { .type = APP_EVENT_CLEAR_DESIRED };
+
 		LOG_ERR("Desired State Decoding Error");
 		LOG_HEXDUMP_ERR(payload, payload_size, "desired_state");
-		app_state_reset_desired();
+		app_event_post(&event);
 		return;
 	}
 }
@@ -33,7 +33,32 @@
 #define APP_STATE_ACTUAL_ENDP  "state"
 
 int app_state_observe(struct golioth_client *state_client);
+int app_state_reset_desired(void);
+
+/**
+ * @brief Send the actual state with the next report, whether or not it changed
+ *
+ * @return 0
+ */
 int app_state_update_actual(void);
-int app_state_report_ontime(adc_node_t *ch0, adc_node_t *ch1);
+
+/**
+ * @brief Report the live, energy, and cumulative counters of every channel
+ *
+ * The state is only written when a channel turned on or off, a counter was
+ * reset, energy or charge moved by more than CONFIG_APP_STATE_SYNC_*_DELTA,
+ * an update was requested with app_state_update_actual(), or
+ * CONFIG_APP_STATE_SYNC_MAX_INTERVAL_S passed since the last write.
+ *
+ * The result of the write is passed to app_sensors_report_done() with @p seq.
+ *
+ * @param counters Snapshot of the counters
+ * @param count Number of entries in @p counters
+ * @param seq Sequence number of the write, also sent as "cumulative_seq"
+ *
+ * @return 0 if the state was sent, -EAGAIN if nothing worth sending changed,
+ *         or a negative error code
+ */
+int app_state_report_ontime(const struct adc_counters *counters, size_t count, uint32_t seq);
 
 #endif /* __APP_STATE_H__ */
@@ -0,0 +1,640 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_store, LOG_LEVEL_DBG);
+
+#include <string.h>
+#include <golioth/client.h>
+#include <golioth/stream.h>
+#include <zephyr/fs/fcb.h>
+#include <zephyr/kernel.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "app_store.h"
+
+#define STORE_PARTITION_ID FIXED_PARTITION_ID(telemetry_storage)
+#define STORE_MAGIC	   0x50574d51 /* "PWMQ" */
+#define STORE_VERSION	   2
+#define STORE_MAX_SECTORS  16
+#define STORE_PATH_MAX	   32
+#define STORE_NO_AGE	   0xffff
+
+/*
+ * Each entry is a header, the stream path (not terminated) and the payload.
+ * An entry with no path marks everything before it as replayed.
+ */
+struct store_entry_hdr {
+	uint8_t content_type;
+	uint8_t path_len;
+	/* Offset of the age slot in the payload, or STORE_NO_AGE */
+	uint16_t age_offset;
+	/* Capture time on the store clock, in milliseconds */
+	int64_t captured;
+} __packed;
+
+BUILD_ASSERT(sizeof(struct store_entry_hdr) == APP_STORE_ENTRY_OVERHEAD);
+
+enum slot_state {
+	SLOT_FREE,
+	SLOT_SENDING,
+	/* Request failed; to be queued in flash by the replay thread */
+	SLOT_FAILED,
+};
+
+/* Copy of a payload sent directly, kept until the server answers */
+struct store_slot {
+	struct store_entry_hdr hdr;
+	char path[STORE_PATH_MAX];
+	uint8_t payload[CONFIG_APP_STORE_MAX_ENTRY_SIZE];
+	size_t len;
+	/* Order in which the slots were sent, to requeue failures in order */
+	uint32_t seq;
+	enum slot_state state;
+};
+
+static struct golioth_client *client;
+
+static struct store_slot slots[CONFIG_APP_STORE_MAX_INFLIGHT];
+static uint32_t slot_seq;
+static struct k_spinlock slot_lock;
+
+/*
+ * Uptime restarts at zero after a reboot, so capture times are kept on a
+ * clock that starts at the newest capture found in flash. Entries from before
+ * the reboot are then aged as if the device had been off for no time.
+ */
+static int64_t clock_base;
+
+static struct fcb store_fcb;
+static struct flash_sector store_sectors[STORE_MAX_SECTORS];
+static bool store_ready;
+static K_MUTEX_DEFINE(store_mutex);
+
+/* Last entry that was replayed or marker found at boot; fe_sector is NULL if none */
+static struct fcb_entry read_loc;
+static atomic_t pending;
+
+/* Extra space lets writes be padded to the flash write block size */
+static uint8_t append_buf[CONFIG_APP_STORE_MAX_ENTRY_SIZE + 8];
+static uint8_t replay_buf[CONFIG_APP_STORE_MAX_ENTRY_SIZE];
+
+static K_SEM_DEFINE(replay_sem, 0, 1);
+
+K_THREAD_STACK_DEFINE(store_wq_stack, CONFIG_APP_STORE_WQ_STACK_SIZE);
+static struct k_work_q store_wq;
+
+static int read_hdr(const struct fcb_entry *loc, struct store_entry_hdr *hdr)
+{
+	if (loc->fe_data_len < sizeof(*hdr)) {
+		return -EBADMSG;
+	}
+
+	return flash_area_read(store_fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), hdr, sizeof(*hdr));
+}
+
+/* Count the entries after read_loc, apart from markers; caller must hold store_mutex */
+static int count_pending(void)
+{
+	struct fcb_entry loc = read_loc;
+	struct store_entry_hdr hdr;
+	int count = 0;
+
+	while (fcb_getnext(&store_fcb, &loc) == 0) {
+		if ((read_hdr(&loc, &hdr) != 0) || (hdr.path_len != 0)) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Resume after the last marker and return the latest capture time in the
+ * queue, or 0; caller must hold store_mutex
+ */
+static int64_t scan_queue(void)
+{
+	struct fcb_entry loc = { 0 };
+	struct store_entry_hdr hdr;
+	int64_t newest = 0;
+
+	read_loc.fe_sector = NULL;
+
+	while (fcb_getnext(&store_fcb, &loc) == 0) {
+		if (read_hdr(&loc, &hdr) != 0) {
+			continue;
+		}
+
+		newest = MAX(newest, hdr.captured);
+
+		if (hdr.path_len == 0) {
+			read_loc = loc;
+		}
+	}
+
+	return newest;
+}
+
+/*
+ * Make room by erasing the oldest sector. Sectors are only erased here, when
+ * the queue has wrapped, so replaying does not wear the flash. Caller must
+ * hold store_mutex.
+ */
+static int drop_oldest_sector(void)
+{
+	int before = atomic_get(&pending);
+	int err;
+
+	if (read_loc.fe_sector == store_fcb.f_oldest) {
+		/* Unsent entries in this sector are lost; restart at the new oldest */
+		read_loc.fe_sector = NULL;
+	}
+
+	err = fcb_rotate(&store_fcb);
+	if (err) {
+		LOG_ERR("Unable to erase oldest sector: %d", err);
+		return err;
+	}
+
+	atomic_set(&pending, count_pending());
+
+	/* Usually the oldest sector was already replayed */
+	if (atomic_get(&pending) < before) {
+		LOG_WRN("Telemetry queue full; oldest entries dropped");
+	}
+
+	return 0;
+}
+
+static int64_t store_now(void)
+{
+	return k_uptime_get() + clock_base;
+}
+
+/* Write the time since capture into the payload's age slot, if it has one */
+static void set_age(uint8_t *payload, size_t len, const struct store_entry_hdr *hdr)
+{
+	int64_t age = store_now() - hdr->captured;
+
+	if ((hdr->age_offset == STORE_NO_AGE) || (hdr->age_offset + APP_STORE_AGE_SIZE > len)) {
+		return;
+	}
+
+	if (!IN_RANGE(age, 0, APP_STORE_AGE_UNKNOWN - 1)) {
+		age = APP_STORE_AGE_UNKNOWN;
+	}
+
+	sys_put_be32(age, payload + hdr->age_offset);
+}
+
+/* Write one entry; caller must hold store_mutex */
+static int append_entry(const char *path, const struct store_entry_hdr *hdr,
+			const uint8_t *payload, size_t len, struct fcb_entry *loc)
+{
+	size_t entry_len = sizeof(*hdr) + hdr->path_len + len;
+	int err;
+
+	err = fcb_append(&store_fcb, entry_len, loc);
+	if (err == -ENOSPC) {
+		err = drop_oldest_sector();
+		if (!err) {
+			err = fcb_append(&store_fcb, entry_len, loc);
+		}
+	}
+	if (err) {
+		LOG_ERR("Unable to reserve space in telemetry queue: %d", err);
+		return err;
+	}
+
+	memset(append_buf, 0xff, sizeof(append_buf));
+	memcpy(append_buf, hdr, sizeof(*hdr));
+	memcpy(append_buf + sizeof(*hdr), path, hdr->path_len);
+	if (len > 0) {
+		memcpy(append_buf + sizeof(*hdr) + hdr->path_len, payload, len);
+	}
+
+	err = flash_area_write(store_fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), append_buf,
+			       ROUND_UP(entry_len, store_fcb.f_align));
+	if (err) {
+		LOG_ERR("Unable to write telemetry queue entry: %d", err);
+		return err;
+	}
+
+	err = fcb_append_finish(&store_fcb, loc);
+	if (err) {
+		LOG_ERR("Unable to finish telemetry queue entry: %d", err);
+	}
+
+	return err;
+}
+
+static int store_append(const char *path, const struct store_entry_hdr *entry,
+			const uint8_t *payload, size_t len)
+{
+	struct store_entry_hdr hdr = *entry;
+	struct fcb_entry loc;
+	int err;
+
+	if (!store_ready) {
+		return -ENODEV;
+	}
+
+	hdr.path_len = strlen(path);
+
+	if (sizeof(hdr) + hdr.path_len + len > CONFIG_APP_STORE_MAX_ENTRY_SIZE) {
+		LOG_ERR("Payload for %s is too large to queue: %d", path, (int)len);
+		return -ENOMEM;
+	}
+
+	k_mutex_lock(&store_mutex, K_FOREVER);
+
+	err = append_entry(path, &hdr, payload, len, &loc);
+	if (!err) {
+		atomic_inc(&pending);
+	}
+
+	k_mutex_unlock(&store_mutex);
+	return err;
+}
+
+/* Read the next entry to replay into replay_buf; caller must hold store_mutex */
+static int read_next(struct fcb_entry *loc, char *path, size_t path_size,
+		     struct store_entry_hdr *entry, size_t *payload_len)
+{
+	struct store_entry_hdr hdr;
+	int err;
+
+	*loc = read_loc;
+
+	err = fcb_getnext(&store_fcb, loc);
+	if (err) {
+		return -ENOENT;
+	}
+
+	if ((loc->fe_data_len > sizeof(replay_buf)) || (loc->fe_data_len < sizeof(hdr))) {
+		return -EBADMSG;
+	}
+
+	err = flash_area_read(store_fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), replay_buf,
+			      loc->fe_data_len);
+	if (err) {
+		return err;
+	}
+
+	memcpy(&hdr, replay_buf, sizeof(hdr));
+	if (hdr.path_len == 0) {
+		return -ENODATA;
+	}
+
+	if ((hdr.path_len >= path_size) || (sizeof(hdr) + hdr.path_len > loc->fe_data_len)) {
+		return -EBADMSG;
+	}
+
+	memcpy(path, replay_buf + sizeof(hdr), hdr.path_len);
+	path[hdr.path_len] = '\0';
+
+	*entry = hdr;
+	*payload_len = loc->fe_data_len - sizeof(hdr) - hdr.path_len;
+
+	return sizeof(hdr) + hdr.path_len;
+}
+
+/* Mark an entry as replayed; caller must hold store_mutex */
+static void consume(const struct fcb_entry *loc)
+{
+	struct store_entry_hdr marker = {
+		.age_offset = STORE_NO_AGE,
+		.captured = store_now(),
+	};
+	struct fcb_entry marker_loc;
+
+	read_loc = *loc;
+
+	if (atomic_dec(&pending) != 1) {
+		return;
+	}
+
+	/*
+	 * Everything has been replayed. Sectors are left for the FCB to reuse;
+	 * the marker lets a reboot resume here instead of replaying them again.
+	 */
+	if (append_entry("", &marker, NULL, 0, &marker_loc) == 0) {
+		read_loc = marker_loc;
+	}
+}
+
+static struct store_slot *slot_get(void)
+{
+	struct store_slot *slot = NULL;
+	k_spinlock_key_t key = k_spin_lock(&slot_lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].state == SLOT_FREE) {
+			slot = &slots[i];
+			slot->state = SLOT_SENDING;
+			slot->seq = slot_seq++;
+			break;
+		}
+	}
+
+	k_spin_unlock(&slot_lock, key);
+
+	return slot;
+}
+
+static void slot_set_state(struct store_slot *slot, enum slot_state state)
+{
+	k_spinlock_key_t key = k_spin_lock(&slot_lock);
+
+	slot->state = state;
+
+	k_spin_unlock(&slot_lock, key);
+}
+
+static void stream_response_handler(struct golioth_client *client,
+				    const struct golioth_response *response,
+				    const char *path,
+				    void *arg)
+{
+	struct store_slot *slot = arg;
+
+	if (response->status != GOLIOTH_OK) {
+		LOG_WRN("Failed to stream to %s: %d", path, response->status);
+	}
+
+	if (!slot) {
+		/* Too large to keep a copy of; nothing to requeue */
+		return;
+	}
+
+	if ((response->status == GOLIOTH_OK) || (response->status == GOLIOTH_ERR_COAP_RESPONSE)) {
+		/* Delivered, or rejected by the server so that sending it again would not help */
+		slot_set_state(slot, SLOT_FREE);
+		return;
+	}
+
+	/* Flash writes are left to the replay thread, off the client thread */
+	slot_set_state(slot, SLOT_FAILED);
+	app_store_kick();
+}
+
+/* Take the failed slot that was sent first, or return NULL */
+static struct store_slot *slot_take_failed(void)
+{
+	struct store_slot *slot = NULL;
+	k_spinlock_key_t key = k_spin_lock(&slot_lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(slots); i++) {
+		/* Sequence numbers wrap, so compare the difference */
+		if ((slots[i].state == SLOT_FAILED) &&
+		    (!slot || ((int32_t)(slots[i].seq - slot->seq) < 0))) {
+			slot = &slots[i];
+		}
+	}
+
+	if (slot) {
+		/* Keeps another thread from queueing it too */
+		slot->state = SLOT_SENDING;
+	}
+
+	k_spin_unlock(&slot_lock, key);
+
+	return slot;
+}
+
+/*
+ * Queue payloads whose direct send failed, oldest first, so they are
+ * replayed like the rest. Called before anything else is queued or replayed
+ * so that nothing newer gets ahead of them.
+ */
+static void requeue_failed(void)
+{
+	struct store_slot *slot;
+
+	while ((slot = slot_take_failed()) != NULL) {
+		if (store_append(slot->path, &slot->hdr, slot->payload, slot->len)) {
+			LOG_ERR("Unable to queue failed payload for %s", slot->path);
+		}
+
+		slot_set_state(slot, SLOT_FREE);
+	}
+}
+
+static void replay_thread(void *arg1, void *arg2, void *arg3)
+{
+	char path[STORE_PATH_MAX];
+	struct store_entry_hdr hdr;
+	struct fcb_entry loc;
+	size_t payload_len;
+	int offset;
+	int err;
+
+	while (true) {
+		/* Retry periodically in case a replay was interrupted */
+		k_sem_take(&replay_sem, K_SECONDS(CONFIG_APP_STORE_RETRY_S));
+
+		requeue_failed();
+
+		if (atomic_get(&pending) > 0) {
+			LOG_INF("Replaying %d queued telemetry entries", (int)atomic_get(&pending));
+		}
+
+		while ((atomic_get(&pending) > 0) && client && golioth_client_is_connected(client)) {
+			/* A send that failed since the last entry goes ahead of newer entries */
+			requeue_failed();
+
+			k_mutex_lock(&store_mutex, K_FOREVER);
+			offset = read_next(&loc, path, sizeof(path), &hdr, &payload_len);
+			k_mutex_unlock(&store_mutex);
+
+			if (offset == -ENODATA) {
+				/* Marker left by an earlier drain */
+				k_mutex_lock(&store_mutex, K_FOREVER);
+				read_loc = loc;
+				k_mutex_unlock(&store_mutex);
+				continue;
+			} else if (offset == -EBADMSG) {
+				LOG_ERR("Skipping corrupt telemetry queue entry");
+				k_mutex_lock(&store_mutex, K_FOREVER);
+				consume(&loc);
+				k_mutex_unlock(&store_mutex);
+				continue;
+			} else if (offset < 0) {
+				LOG_ERR("Unable to read telemetry queue: %d", offset);
+				break;
+			}
+
+			set_age(replay_buf + offset, payload_len, &hdr);
+
+			/* Wait for the server to acknowledge before moving on */
+			err = golioth_stream_set_sync(client, path, hdr.content_type,
+						      replay_buf + offset, payload_len,
+						      CONFIG_APP_STORE_RETRY_S);
+			if (err) {
+				LOG_WRN("Replay to %s failed: %d", path, err);
+				break;
+			}
+
+			k_mutex_lock(&store_mutex, K_FOREVER);
+			consume(&loc);
+			k_mutex_unlock(&store_mutex);
+
+			/* Bound the replay rate so live traffic is not starved */
+			k_msleep(CONFIG_APP_STORE_REPLAY_INTERVAL_MS);
+		}
+	}
+}
+
+K_THREAD_DEFINE(store_replay_tid, CONFIG_APP_STORE_STACK_SIZE, replay_thread, NULL, NULL, NULL,
+		CONFIG_APP_STORE_THREAD_PRIORITY, 0, 0);
+
+static int stream_or_queue(const char *path, enum golioth_content_type content_type,
+			   uint8_t *payload, size_t len, int64_t captured, int age_offset,
+			   bool in_order)
+{
+	struct store_entry_hdr hdr = {
+		.content_type = content_type,
+		.age_offset = (age_offset >= 0) ? age_offset : STORE_NO_AGE,
+		.captured = captured + clock_base,
+	};
+	struct store_slot *slot = NULL;
+	int err;
+
+	/* An empty path would be taken for a marker */
+	if ((path[0] == '\0') || (strlen(path) >= STORE_PATH_MAX) ||
+	    ((age_offset >= 0) && (age_offset + APP_STORE_AGE_SIZE > len))) {
+		return -EINVAL;
+	}
+
+	if (in_order) {
+		/* Failed sends go ahead of this payload, and hold it back from a direct send */
+		requeue_failed();
+	}
+
+	if (client && golioth_client_is_connected(client) &&
+	    (!in_order || (atomic_get(&pending) == 0))) {
+		if (len > sizeof(slot->payload)) {
+			/* Could not be queued either, so send it without a copy to requeue */
+			set_age(payload, len, &hdr);
+			return golioth_stream_set_async(client, path, content_type, payload, len,
+							stream_response_handler, NULL);
+		}
+
+		/* Without a free slot the payload is queued so that it cannot be lost */
+		slot = slot_get();
+	}
+
+	if (slot) {
+		slot->hdr = hdr;
+		strcpy(slot->path, path);
+		memcpy(slot->payload, payload, len);
+		slot->len = len;
+		set_age(slot->payload, len, &hdr);
+
+		err = golioth_stream_set_async(client, slot->path, content_type, slot->payload,
+					       len, stream_response_handler, slot);
+		if (err == 0) {
+			return 0;
+		}
+
+		slot_set_state(slot, SLOT_FREE);
+		LOG_WRN("Failed to send to %s, queueing: %d", path, err);
+	}
+
+	err = store_append(path, &hdr, payload, len);
+	if (err) {
+		return err;
+	}
+
+	app_store_kick();
+	return 0;
+}
+
+int app_store_stream(const char *path, enum golioth_content_type content_type,
+		     uint8_t *payload, size_t len, int64_t captured, int age_offset)
+{
+	return stream_or_queue(path, content_type, payload, len, captured, age_offset, true);
+}
+
+int app_store_stream_urgent(const char *path, enum golioth_content_type content_type,
+			    uint8_t *payload, size_t len, int64_t captured, int age_offset)
+{
+	return stream_or_queue(path, content_type, payload, len, captured, age_offset, false);
+}
+
+void app_store_kick(void)
+{
+	k_sem_give(&replay_sem);
+}
+
+void app_store_set_client(struct golioth_client *store_client)
+{
+	client = store_client;
+}
+
+struct k_work_q *app_store_work_q(void)
+{
+	return &store_wq;
+}
+
+int app_store_init(void)
+{
+	uint32_t sector_cnt = ARRAY_SIZE(store_sectors);
+	struct k_work_queue_config cfg = {
+		.name = "store",
+	};
+	const struct flash_area *fa;
+	int err;
+
+	/* Started even if the flash is unusable, so producers still send while online */
+	k_work_queue_start(&store_wq, store_wq_stack, K_THREAD_STACK_SIZEOF(store_wq_stack),
+			   CONFIG_APP_STORE_THREAD_PRIORITY, &cfg);
+
+	err = flash_area_get_sectors(STORE_PARTITION_ID, &sector_cnt, store_sectors);
+	if (err) {
+		LOG_ERR("Unable to get telemetry storage sectors: %d", err);
+		return err;
+	}
+
+	store_fcb.f_magic = STORE_MAGIC;
+	store_fcb.f_version = STORE_VERSION;
+	store_fcb.f_sector_cnt = sector_cnt;
+	store_fcb.f_scratch_cnt = 0;
+	store_fcb.f_sectors = store_sectors;
+
+	err = fcb_init(STORE_PARTITION_ID, &store_fcb);
+	if (err) {
+		/* Partition holds something else; start over with an empty queue */
+		LOG_WRN("Erasing telemetry storage: %d", err);
+
+		err = flash_area_open(STORE_PARTITION_ID, &fa);
+		if (!err) {
+			err = flash_area_erase(fa, 0, fa->fa_size);
+			flash_area_close(fa);
+		}
+		if (!err) {
+			err = fcb_init(STORE_PARTITION_ID, &store_fcb);
+		}
+		if (err) {
+			LOG_ERR("Unable to initialize telemetry storage: %d", err);
+			return err;
+		}
+	}
+
+	k_mutex_lock(&store_mutex, K_FOREVER);
+	clock_base = scan_queue();
+	atomic_set(&pending, count_pending());
+	k_mutex_unlock(&store_mutex);
+
+	store_ready = true;
+	LOG_INF("Telemetry queue holds %d entries", (int)atomic_get(&pending));
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Store-and-forward queue for Golioth Stream data.
+ *
+ * Payloads that cannot be sent because the client is offline are appended to
+ * a Flash Circular Buffer (FCB) on the `telemetry_storage` partition. Once the
+ * client is connected they are replayed in order, one acknowledged message at
+ * a time, so a long outage does not leave a gap in the data.
+ *
+ * Payloads sent directly are kept in RAM until the server answers. If the
+ * request fails, for example because it timed out, the payload is queued and
+ * replayed with the rest.
+ *
+ * A queued payload may be sent long after it was captured. Its timestamps are
+ * therefore relative to a capture time, and the payload can reserve an age
+ * slot: APP_STORE_AGE_SIZE bytes that the store fills, big-endian, with the
+ * milliseconds from capture to each send. Uptime restarts at zero after a
+ * reboot, so entries queued before one are aged as if the device had been
+ * off for no time.
+ *
+ * Replayed sectors are not erased until the queue wraps around. Instead a
+ * small marker entry is written each time the queue is emptied, and the
+ * replay resumes after the last marker at boot. Delivery is at-least-once: a
+ * reboot during a replay resends the entries replayed since the queue was
+ * last empty.
+ */
+
+#ifndef __APP_STORE_H__
+#define __APP_STORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <golioth/client.h>
+
+/** Size of the age slot in a payload */
+#define APP_STORE_AGE_SIZE 4
+
+/** Placeholder for the age slot; also sent if the age does not fit */
+#define APP_STORE_AGE_UNKNOWN UINT32_MAX
+
+/** Bytes queued with each payload in addition to the payload and its path */
+#define APP_STORE_ENTRY_OVERHEAD 12
+
+/** @brief Mount the flash queue; payloads already queued will be replayed */
+int app_store_init(void);
+
+/**
+ * @brief Work queue for deferred work that streams through this module
+ *
+ * Queueing a payload may write and erase flash, so such work should not run
+ * on the system work queue. Started by app_store_init().
+ */
+struct k_work_q *app_store_work_q(void);
+
+void app_store_set_client(struct golioth_client *store_client);
+
+/**
+ * @brief Send a payload to Golioth Stream, or queue it in flash if that is not possible
+ *
+ * Payloads are queued while the client is disconnected, and also while older
+ * payloads are still waiting to be replayed so that ordering is preserved.
+ *
+ * @param payload Payload; its age slot is overwritten
+ * @param captured Uptime in milliseconds that the payload's timestamps are relative to
+ * @param age_offset Offset of the age slot in @p payload, or -1 if there is none
+ *
+ * @return 0 if the payload was sent or queued, or a negative error code
+ */
+int app_store_stream(const char *path, enum golioth_content_type content_type,
+		     uint8_t *payload, size_t len, int64_t captured, int age_offset);
+
+/**
+ * @brief Send a payload ahead of any payloads waiting to be replayed
+ *
+ * For events that must not wait behind a long replay. The payload is queued
+ * in flash only if the client is disconnected or the request fails.
+ *
+ * @return 0 if the payload was sent or queued, or a negative error code
+ */
+int app_store_stream_urgent(const char *path, enum golioth_content_type content_type,
+			    uint8_t *payload, size_t len, int64_t captured, int age_offset);
+
+/** @brief Start replaying queued payloads if the client is connected */
+void app_store_kick(void);
+
+#endif /* __APP_STORE_H__ */
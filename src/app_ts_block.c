@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app_ts_block, LOG_LEVEL_DBG);
+
+#include <string.h>
+#include <golioth/client.h>
+#include <zephyr/kernel.h>
+
+#include "app_store.h"
+#include "app_ts_block.h"
+
+#define TS_STREAM_ENDP "sensor/ts"
+
+#define TS_MAGIC_0 'T'
+#define TS_MAGIC_1 'S'
+#define TS_VERSION 2
+
+/* Largest varints: 64-bit delta-of-delta (shifted by one bit), 16-bit deltas, 32-bit run */
+#define VARINT64_MAX_SIZE 10
+#define VARINT32_MAX_SIZE 5
+#define VARINT16_MAX_SIZE 3
+#define TS_RECORD_MAX_SIZE \
+	(VARINT64_MAX_SIZE + (3 * VARINT16_MAX_SIZE) + VARINT32_MAX_SIZE)
+
+/* Magic, version, channel count and the age slot filled in by the store */
+#define TS_HDR_SIZE (4 + APP_STORE_AGE_SIZE)
+#define TS_AGE_OFFSET 4
+
+/* Channel number, sample count, start time and body length precede each body */
+#define TS_CHANNEL_HDR_MAX_SIZE (1 + VARINT32_MAX_SIZE + VARINT64_MAX_SIZE + VARINT32_MAX_SIZE)
+#define TS_UPLOAD_MAX_SIZE \
+	(TS_HDR_SIZE + (ADC_NUM_CHANNELS * (TS_CHANNEL_HDR_MAX_SIZE + CONFIG_APP_TS_BLOCK_SIZE)))
+
+BUILD_ASSERT(TS_UPLOAD_MAX_SIZE + APP_STORE_ENTRY_OVERHEAD + sizeof(TS_STREAM_ENDP) <=
+		     CONFIG_APP_STORE_MAX_ENTRY_SIZE,
+	     "Time-series block does not fit in the offline queue; lower APP_TS_BLOCK_SIZE");
+
+/* Encoder state for one channel */
+struct ts_channel {
+	uint8_t body[CONFIG_APP_TS_BLOCK_SIZE];
+	size_t len;
+	uint32_t count;
+	/* Number of flat samples not yet written to body */
+	uint32_t run;
+	/* Uptime in milliseconds of the first sample in the block */
+	int64_t t0;
+	int64_t prev_t;
+	int64_t prev_dt;
+	vcp_raw_t prev;
+};
+
+static struct ts_channel channels[ADC_NUM_CHANNELS];
+static K_MUTEX_DEFINE(ts_mutex);
+
+static uint8_t upload_buf[TS_UPLOAD_MAX_SIZE];
+
+static void flush_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(flush_work, flush_work_handler);
+
+static size_t put_uvarint(uint8_t *buf, uint64_t value)
+{
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = value;
+
+	return len;
+}
+
+static inline uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static size_t put_svarint(uint8_t *buf, int64_t value)
+{
+	return put_uvarint(buf, zigzag(value));
+}
+
+static void ts_channel_reset(struct ts_channel *ch)
+{
+	memset(ch, 0, sizeof(*ch));
+}
+
+/* Write out any pending run of flat samples */
+static void ts_channel_end_run(struct ts_channel *ch)
+{
+	if (ch->run > 0) {
+		ch->len += put_uvarint(&ch->body[ch->len], ((uint64_t)ch->run << 1) | 1);
+		ch->run = 0;
+	}
+}
+
+static void ts_channel_add(struct ts_channel *ch, const struct app_sample *sample)
+{
+	int64_t t = k_ticks_to_ms_floor64(sample->ts);
+	int64_t dt, dod;
+	int32_t dcur, dvol, dpow;
+
+	if (ch->count == 0) {
+		/* Decoding starts from zero values at t0, so the first record holds absolutes */
+		ch->t0 = t;
+		ch->prev_t = t;
+	}
+
+	dt = t - ch->prev_t;
+	dod = dt - ch->prev_dt;
+	dcur = sample->raw.current - ch->prev.current;
+	dvol = sample->raw.voltage - ch->prev.voltage;
+	dpow = sample->raw.power - ch->prev.power;
+
+	if ((dod == 0) && (dcur == 0) && (dvol == 0) && (dpow == 0) && (ch->run < UINT32_MAX)) {
+		ch->run++;
+	} else {
+		ts_channel_end_run(ch);
+		ch->len += put_uvarint(&ch->body[ch->len], zigzag(dod) << 1);
+		ch->len += put_svarint(&ch->body[ch->len], dcur);
+		ch->len += put_svarint(&ch->body[ch->len], dvol);
+		ch->len += put_svarint(&ch->body[ch->len], dpow);
+	}
+
+	ch->prev_t = t;
+	ch->prev_dt = dt;
+	ch->prev = sample->raw;
+	ch->count++;
+}
+
+/* Encode and send every channel that has samples; caller must hold ts_mutex */
+static int send_block(void)
+{
+	int64_t now = k_uptime_get();
+	size_t len = 0;
+	size_t num_channels = 0;
+	int err;
+
+	upload_buf[len++] = TS_MAGIC_0;
+	upload_buf[len++] = TS_MAGIC_1;
+	upload_buf[len++] = TS_VERSION;
+	len++; /* Channel count is filled in below */
+	memset(&upload_buf[len], 0xff, APP_STORE_AGE_SIZE);
+	len += APP_STORE_AGE_SIZE;
+
+	for (size_t i = 0; i < ARRAY_SIZE(channels); i++) {
+		struct ts_channel *ch = &channels[i];
+
+		if (ch->count == 0) {
+			continue;
+		}
+
+		ts_channel_end_run(ch);
+
+		/* Start time is relative to the capture time; the age is added when sent */
+		upload_buf[len++] = i;
+		len += put_uvarint(&upload_buf[len], ch->count);
+		len += put_svarint(&upload_buf[len], ch->t0 - now);
+		len += put_uvarint(&upload_buf[len], ch->len);
+		memcpy(&upload_buf[len], ch->body, ch->len);
+		len += ch->len;
+
+		LOG_DBG("ch%d: %u samples in %d bytes", (int)i, ch->count, (int)ch->len);
+
+		ts_channel_reset(ch);
+		num_channels++;
+	}
+
+	if (num_channels == 0) {
+		return 0;
+	}
+
+	upload_buf[3] = num_channels;
+
+	/* Queued in flash if the client is offline */
+	err = app_store_stream(TS_STREAM_ENDP,
+			       GOLIOTH_CONTENT_TYPE_OCTET_STREAM,
+			       upload_buf,
+			       len,
+			       now,
+			       TS_AGE_OFFSET);
+	if (err) {
+		LOG_ERR("Failed to send time-series block to Golioth: %d", err);
+		return err;
+	}
+
+	return 0;
+}
+
+static void flush_work_handler(struct k_work *work)
+{
+	k_mutex_lock(&ts_mutex, K_FOREVER);
+	send_block();
+	k_mutex_unlock(&ts_mutex);
+}
+
+int app_ts_block_add(uint8_t ch_num, const struct app_sample *samples, size_t count)
+{
+	struct ts_channel *ch;
+
+	if (ch_num >= ARRAY_SIZE(channels)) {
+		return -EINVAL;
+	}
+
+	ch = &channels[ch_num];
+
+	k_mutex_lock(&ts_mutex, K_FOREVER);
+
+	for (size_t i = 0; i < count; i++) {
+		if (ch->len + TS_RECORD_MAX_SIZE > sizeof(ch->body)) {
+			/* Send everything now so the channels stay roughly aligned in time */
+			send_block();
+		}
+
+		if (ch->count == 0) {
+			/* Does nothing if the age timer is already running */
+			k_work_schedule_for_queue(app_store_work_q(), &flush_work,
+						  K_SECONDS(CONFIG_APP_TS_BLOCK_MAX_AGE_S));
+		}
+
+		ts_channel_add(ch, &samples[i]);
+	}
+
+	k_mutex_unlock(&ts_mutex);
+
+	return 0;
+}
+
+void app_ts_block_flush(void)
+{
+	k_work_reschedule_for_queue(app_store_work_q(), &flush_work, K_NO_WAIT);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Compressed time-series blocks of raw INA260 samples.
+ *
+ * Every sample taken by the sampler is encoded with delta-of-delta
+ * timestamps, zig-zag varint deltas of the raw register values, and run-length
+ * encoding of flat segments. Blocks are uploaded to the "sensor/ts" Stream
+ * path as a binary payload. The format is documented in the README and
+ * `utility/ts_block_decode.py` decodes it.
+ *
+ * A block is sent when a channel's buffer is full, when the oldest sample is
+ * `CONFIG_APP_TS_BLOCK_MAX_AGE_S` seconds old, or when app_ts_block_flush() is
+ * called.
+ */
+
+#ifndef __APP_TS_BLOCK_H__
+#define __APP_TS_BLOCK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "app_sampler.h"
+
+/**
+ * @brief Append raw samples for one channel to the current block
+ *
+ * @param ch_num Channel number
+ * @param samples Samples in the order they were taken
+ * @param count Number of entries in @p samples
+ *
+ * @return 0 on success, or a negative error code
+ */
+int app_ts_block_add(uint8_t ch_num, const struct app_sample *samples, size_t count);
+
+/**
+ * @brief Send the current block as soon as possible
+ *
+ * Safe to call from any context, including interrupts.
+ */
+void app_ts_block_flush(void);
+
+#endif /* __APP_TS_BLOCK_H__ */
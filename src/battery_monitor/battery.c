@@ -19,16 +19,15 @@
 #include <golioth/stream.h>
 
 #include "battery_monitor/battery.h"
+#include "../app_encode.h"
 #include "../app_sensors.h"
+#include "../app_store.h"
 
 LOG_MODULE_REGISTER(battery, LOG_LEVEL_DBG);
 
 #define VBATT	    DT_PATH(vbatt)
 #define ZEPHYR_USER DT_PATH(zephyr_user)
 
-/* Formatting string for sending battery JSON to Golioth */
-#define JSON_FMT "{\"batt_v\":%d.%03d,\"batt_lvl\":%d.%02d}"
-
 #define LABEL_BATTERY "Battery"
 
 #ifdef CONFIG_BOARD_THINGY52_NRF52832
@@ -310,36 +309,26 @@ void log_battery_data(void)
 	LOG_INF("Battery measurement: voltage=%s, level=%s", get_batt_v_str(), get_batt_lvl_str());
 }
 
-static void async_error_handler(struct golioth_client *client,
-				const struct golioth_response *response,
-				const char *path,
-				void *arg)
-{
-	if (response->status != GOLIOTH_OK) {
-		LOG_ERR("Failed to stream battery data: %d", response->status);
-		return;
-	}
-}
-
 int stream_battery_data(struct golioth_client *client, struct battery_data *batt_data)
 {
+	int age_offset;
 	int err;
-	/* {"batt_v":X.XXX,"batt_lvl":XXX.XX} */
-	char json_buf[35];
+	int len;
+	uint8_t cbor_buf[APP_ENCODE_BATTERY_MAX_SIZE];
 
 	/* Send battery data to Golioth */
-	snprintk(json_buf, sizeof(json_buf), JSON_FMT, batt_data->battery_voltage_mv / 1000,
-		 batt_data->battery_voltage_mv % 1000, batt_data->battery_level_pptt / 100,
-		 batt_data->battery_level_pptt % 100);
-	LOG_DBG("%s", json_buf);
-
-	err = golioth_stream_set_async(client,
-				       stream_endpoint,
-				       GOLIOTH_CONTENT_TYPE_JSON,
-				       json_buf,
-				       strlen(json_buf),
-				       async_error_handler,
-				       NULL);
+	len = app_encode_battery(cbor_buf, sizeof(cbor_buf), batt_data->battery_voltage_mv,
+				 batt_data->battery_level_pptt, &age_offset);
+	if (len < 0) {
+		return len;
+	}
+
+	err = app_store_stream(stream_endpoint,
+			       GOLIOTH_CONTENT_TYPE_CBOR,
+			       cbor_buf,
+			       len,
+			       k_uptime_get(),
+			       age_offset);
 	if (err) {
 		LOG_ERR("Failed to send battery data to Golioth: %d", err);
 	}
@@ -365,12 +354,10 @@ int read_and_report_battery(struct golioth_client *client)
 
 	log_battery_data();
 
-	if (golioth_client_is_connected(client)) {
-		err = stream_battery_data(client, &batt_data);
-		if (err) {
-			LOG_ERR("Error streaming battery info");
-			return err;
-		}
+	err = stream_battery_data(client, &batt_data);
+	if (err) {
+		LOG_ERR("Error streaming battery info");
+		return err;
 	}
 
 	return 0;
@@ -8,10 +8,15 @@
 LOG_MODULE_REGISTER(golioth_powermonitor, LOG_LEVEL_DBG);
 
 #include <app_version.h>
+#include "app_cumulative.h"
+#include "app_display.h"
+#include "app_event.h"
+#include "app_loop.h"
 #include "app_rpc.h"
 #include "app_settings.h"
 #include "app_state.h"
 #include "app_sensors.h"
+#include "app_store.h"
 #include <golioth/client.h>
 #include <golioth/fw_update.h>
 #include <samples/common/net_connect.h>
@@ -41,7 +46,6 @@ static const char *_current_version =
 	STRINGIFY(APP_VERSION_MAJOR) "." STRINGIFY(APP_VERSION_MINOR) "." STRINGIFY(APP_PATCHLEVEL);
 
 static struct golioth_client *client;
-K_SEM_DEFINE(connected, 0, 1);
 
 static k_tid_t _system_thread = 0;
 
@@ -59,6 +63,16 @@ void wake_system_thread(void)
 	k_wakeup(_system_thread);
 }
 
+#ifdef CONFIG_LIB_OSTENTUS
+static void add_channel_slide(uint8_t ch_num, enum vcp_quantity quantity, const char *name)
+{
+	char label[24];
+	int len = snprintk(label, sizeof(label), "%s ch%d", name, ch_num);
+
+	ostentus_slide_add(o_dev, CH_SLIDE(ch_num, quantity), label, len);
+}
+#endif
+
 static void on_client_event(struct golioth_client *client,
 			    enum golioth_client_event event,
 			    void *arg)
@@ -66,8 +80,13 @@ static void on_client_event(struct golioth_client *client,
 	bool is_connected = (event == GOLIOTH_CLIENT_EVENT_CONNECTED);
 
 	if (is_connected) {
-		k_sem_give(&connected);
+		struct app_event connected_event = { .type = APP_EVENT_CONNECTED };
+
 		golioth_connection_led_set(1);
+		app_store_kick();
+
+		/* Flush what was buffered while offline from the event thread */
+		app_event_post(&connected_event);
 	}
 	LOG_INF("Golioth client %s", is_connected ? "connected" : "disconnected");
 }
@@ -93,7 +112,9 @@ static void start_golioth_client(void)
 	app_state_observe(client);
 
 	/* Set Golioth Client for streaming sensor data */
+	app_store_set_client(client);
 	app_sensors_set_client(client);
+	app_cumulative_set_client(client);
 
 	/* Register Settings service */
 	app_settings_register(client);
@@ -148,6 +169,7 @@ void button_pressed(const struct device *dev, struct gpio_callback *cb, uint32_t
 	/* This function is an Interrupt Service Routine. Do not call functions that
 	 * use other threads, or perform long-running operations here
 	 */
+	app_sensors_request_flush();
 	k_wakeup(_system_thread);
 }
 
@@ -194,6 +216,12 @@ int main(void)
 	/* Get system thread id so loop delay change event can wake main */
 	_system_thread = k_current_get();
 
+	/* Mount the offline telemetry queue before anything is streamed */
+	err = app_store_init();
+	if (err) {
+		LOG_ERR("Unable to initialize telemetry queue: %d", err);
+	}
+
 	/* Initialize Sensors */
 	app_sensors_init();
 
@@ -214,7 +242,7 @@ int main(void)
 	lte_lc_connect_async(lte_handler);
 
 #else
-	/* If nRF9160 is not used, start the Golioth Client and block until connected */
+	/* If nRF9160 is not used, start the Golioth Client; sampling does not wait for it */
 
 	/* Run WiFi/DHCP if necessary */
 	if (IS_ENABLED(CONFIG_GOLIOTH_SAMPLE_COMMON)) {
@@ -223,9 +251,6 @@ int main(void)
 
 	/* Start Golioth client */
 	start_golioth_client();
-
-	/* Block until connected to Golioth */
-	k_sem_take(&connected, K_FOREVER);
 #endif /* CONFIG_SOC_NRF9160 */
 
 	/* Set up user button */
@@ -252,12 +277,11 @@ int main(void)
 		 *  - use the enum in app_sensors.h to add new keys
 		 *  - values are updated using these keys (see app_sensors.c)
 		 */
-		ostentus_slide_add(o_dev, CH0_CURRENT, CH0_CUR_LABEL, strlen(CH0_CUR_LABEL));
-		ostentus_slide_add(o_dev, CH0_POWER, CH0_POW_LABEL, strlen(CH0_POW_LABEL));
-		ostentus_slide_add(o_dev, CH0_VOLTAGE, CH0_VOL_LABEL, strlen(CH0_VOL_LABEL));
-		ostentus_slide_add(o_dev, CH1_CURRENT, CH1_CUR_LABEL, strlen(CH1_CUR_LABEL));
-		ostentus_slide_add(o_dev, CH1_POWER, CH1_POW_LABEL, strlen(CH1_POW_LABEL));
-		ostentus_slide_add(o_dev, CH1_VOLTAGE, CH1_VOL_LABEL, strlen(CH1_VOL_LABEL));
+		for (uint8_t ch = 0; ch < ADC_NUM_CHANNELS; ch++) {
+			add_channel_slide(ch, VCP_CURRENT, CUR_LABEL);
+			add_channel_slide(ch, VCP_POWER, POW_LABEL);
+			add_channel_slide(ch, VCP_VOLTAGE, VOL_LABEL);
+		}
 		IF_ENABLED(CONFIG_ALUDEL_BATTERY_MONITOR, (
 			ostentus_slide_add(o_dev,
 					   BATTERY_V,
@@ -281,9 +305,13 @@ int main(void)
 		ostentus_slideshow(o_dev, 30000);
 	));
 
+	/* Log and display readings on their own schedule */
+	app_display_start();
+
 	while (true) {
 		app_sensors_read_and_stream();
 
-		k_sleep(K_SECONDS(get_loop_delay_s()));
+		/* Sleep until the next period boundary so report time does not add to the period */
+		app_loop_wait(get_loop_delay_s());
 	}
 }
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 Golioth, Inc.
+# SPDX-License-Identifier: Apache-2.0
+
+"""Decode time-series blocks streamed to the "sensor/ts" path.
+
+Usage: ts_block_decode.py [--scaled] FILE
+
+FILE holds one raw block payload, as downloaded from LightDB Stream or
+captured from the device. One CSV row is printed per sample:
+
+    channel,t_ms,current,voltage,power
+
+t_ms is relative to the time the block was sent, or to the time it was
+captured if the block does not record its age. Raw values are printed
+unless --scaled is given, in which case current and voltage are converted to
+Amps and Volts and power to Watts.
+"""
+
+import argparse
+import sys
+
+MAGIC = b"TS"
+VERSION = 2
+AGE_UNKNOWN = 0xFFFFFFFF
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def byte(self):
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def uvarint(self):
+        value = 0
+        shift = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    def svarint(self):
+        return unzigzag(self.uvarint())
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode_body(body, t0, count):
+    """Yield (t_ms, current, voltage, power) for every sample in a channel body"""
+    r = Reader(body)
+    t = t0
+    dt = 0
+    cur = vol = pow_ = 0
+    emitted = 0
+
+    while r.pos < len(body):
+        h = r.uvarint()
+        if h & 1:
+            # Run of samples identical to the previous one at the same interval
+            for _ in range(h >> 1):
+                t += dt
+                emitted += 1
+                yield t, cur, vol, pow_
+        else:
+            dt += unzigzag(h >> 1)
+            t += dt
+            cur += r.svarint()
+            vol += r.svarint()
+            pow_ += r.svarint()
+            emitted += 1
+            yield t, cur, vol, pow_
+
+    if emitted != count:
+        raise ValueError(f"expected {count} samples, decoded {emitted}")
+
+
+def decode(data):
+    """Yield (channel, t_ms, current, voltage, power) for every sample in a block"""
+    r = Reader(data)
+    if data[:2] != MAGIC:
+        raise ValueError("not a time-series block")
+    r.pos = 2
+    version = r.byte()
+    if version != VERSION:
+        raise ValueError(f"unsupported version {version}")
+
+    num_channels = r.byte()
+
+    # Milliseconds from capture to send, filled in by the device on each send
+    age = int.from_bytes(data[r.pos:r.pos + 4], "big")
+    r.pos += 4
+    if age == AGE_UNKNOWN:
+        print("warning: block age unknown; times are relative to capture",
+              file=sys.stderr)
+        age = 0
+
+    for _ in range(num_channels):
+        channel = r.byte()
+        count = r.uvarint()
+        t0 = r.svarint() - age
+        length = r.uvarint()
+        body = data[r.pos:r.pos + length]
+        r.pos += length
+
+        for sample in decode_body(body, t0, count):
+            yield (channel, *sample)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", type=argparse.FileType("rb"))
+    parser.add_argument("--scaled", action="store_true",
+                        help="convert raw readings to A, V and W")
+    args = parser.parse_args()
+
+    print("channel,t_ms,current,voltage,power")
+    for channel, t, cur, vol, pow_ in decode(args.file.read()):
+        if args.scaled:
+            print(f"{channel},{t},{cur * 0.00125:.5f},{vol * 0.00125:.5f},{pow_ * 0.01:.2f}")
+        else:
+            print(f"{channel},{t},{cur},{vol},{pow_}")
+
+
+if __name__ == "__main__":
+    sys.exit(main())